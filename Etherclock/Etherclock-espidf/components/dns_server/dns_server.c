@@ -6,25 +6,47 @@
 
 #include <sys/param.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <stdatomic.h>
 
+#ifdef ESP_PLATFORM
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_check.h"
 #include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "lwip/netdb.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+// POSIX host build, see host/CMakeLists.txt
+#include "dns_server_port.h"
+#endif
 #include "dns_server.h"
 
+#ifndef DNS_PORT
 #define DNS_PORT (53)
-#define DNS_MAX_LEN (256)
+#endif
+#define DNS_MAX_LEN (1024)   // Room for 512+ byte (e.g. EDNS) queries plus answers
+#define DNS_MAX_REPLY_LEN (512)     // The OPT record is dropped, so replies are plain UDP size
+#define DNS_MAX_NAME_LEN (255)
+#define DNS_MAX_LABEL_LEN (63)
 
-#define OPCODE_MASK (0x7800)
+#define OPCODE_MASK (0x0078)
 #define QR_FLAG (1 << 7)
+#define AA_FLAG (1 << 2)
+#define TC_FLAG (1 << 1)
 #define QD_TYPE_A (0x0001)
+#define QD_TYPE_SOA (0x0006)
 #define ANS_TTL_SEC (300)
+#define SELECT_TIMEOUT_MS (500)   // How often the task checks whether it's been stopped
+#define SOCKET_RETRY_MS (1000)    // Delay before recreating a failed socket
 
 static const char *TAG = "example_dns_redirect_server";
 
@@ -56,59 +78,323 @@ typedef struct __attribute__((__packed__))
     uint32_t ip_addr;
 } dns_answer_t;
 
+// SOA authority record for a NODATA reply. It makes the negative answer cacheable
+// (RFC 2308), both names are the root and only `minimum` (the negative TTL) matters
+typedef struct __attribute__((__packed__))
+{
+    uint16_t ptr_offset;
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t data_len;
+    uint8_t mname;
+    uint8_t rname;
+    uint32_t serial;
+    uint32_t refresh;
+    uint32_t retry;
+    uint32_t expire;
+    uint32_t minimum;
+} dns_soa_t;
+
+// Captive portal probes answered with a canned redirect
+static const char *const probe_paths[] = {
+    "/generate_204",                // Android, Chrome OS
+    "/gen_204",                     // Android
+    "/hotspot-detect.html",         // iOS, macOS
+    "/library/test/success.html",   // Older iOS
+    "/ncsi.txt",                    // Windows
+    "/connecttest.txt",             // Windows 10 and later
+    "/redirect",                    // Windows, after connecttest.txt fails
+    "/success.txt",                 // Firefox
+};
+
+static const char probe_redirect[] =
+    "HTTP/1.1 302 Found\r\n"
+    "Location: " DNS_SERVER_PORTAL_URL "\r\n"
+    "Cache-Control: no-store\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Compiled rule, with the name kept in DNS wire format (lowercase) so
+// questions can be matched in place without converting them to a dotted name
+typedef enum {
+    RULE_EXACT,     // "name.com" matches only "name.com"
+    RULE_SUFFIX,    // "*.name.com" matches any name below "name.com"
+} dns_rule_kind_t;
+
+typedef struct {
+    dns_rule_kind_t kind;
+    uint32_t hash;
+    int entry;          // Index into the config entries, lower wins
+    uint8_t name_len;   // Including the terminating zero label
+    uint8_t *name;
+} dns_rule_t;
+
+// Extra socket served by the network task
+typedef struct {
+    int sock;
+    dns_server_responder_cb_t cb;
+    void *arg;
+} dns_responder_t;
+
 // DNS server handle
 struct dns_server_handle {
-    bool started;
+    _Atomic bool started;
+    _Atomic bool running;   // Cleared by the task just before it exits
     TaskHandle_t task;
+    SemaphoreHandle_t responders_lock;
+    dns_responder_t responders[DNS_SERVER_MAX_RESPONDERS];     // Guarded by responders_lock
+    int num_of_responders;                                      // Guarded by responders_lock
+    int match_all;      // Entry index of the first "*" rule, or -1
+    int num_of_rules;
+    dns_rule_t *rules;
+    uint32_t index_mask;
+    uint16_t *index;    // Open addressed hash of rules, rule index + 1, 0 is empty
+    _Atomic uint32_t *if_addr;  // Per entry IP of if_key, refreshed on IP_EVENT
+    esp_event_handler_instance_t ip_event;
+    struct {
+        _Atomic uint32_t queries;
+        _Atomic uint32_t answered;
+        _Atomic uint32_t unmatched;
+        _Atomic uint32_t nodata;
+        _Atomic uint32_t malformed;
+        _Atomic uint32_t send_errors;
+        _Atomic uint32_t latency[DNS_SERVER_LATENCY_BUCKETS];
+    } stats;
     int num_of_entries;
     dns_entry_pair_t entry[];
 };
 
+// FNV-1a over the lowercased wire format name
+static uint32_t hash_name(const uint8_t *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)tolower(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Label length bytes are at most 63 so tolower() leaves them alone
+static bool names_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
-    Parse the name from the packet from the DNS name format to a regular .-seperated name
-    returns the pointer to the next part of the packet
+    Convert a dotted name to lowercase DNS wire format
+    returns the length of the wire name including the terminating zero label or -1
 */
-static char *parse_dns_name(char *raw_name, char *parsed_name, size_t parsed_name_max_len)
+static int compile_name(const char *dotted, uint8_t *wire, size_t wire_max_len)
 {
+    size_t len = 0;
+    while (*dotted) {
+        const char *dot = strchr(dotted, '.');
+        size_t label_len = dot ? (size_t)(dot - dotted) : strlen(dotted);
+        if (label_len == 0 || label_len > DNS_MAX_LABEL_LEN || len + label_len + 2 > wire_max_len) {
+            return -1;
+        }
+        wire[len++] = label_len;
+        for (size_t i = 0; i < label_len; ++i) {
+            wire[len++] = tolower((unsigned char)dotted[i]);
+        }
+        dotted += label_len + (dot ? 1 : 0);
+    }
+    wire[len++] = 0;
+    return len;
+}
 
-    char *label = raw_name;
-    char *name_itr = parsed_name;
-    int name_len = 0;
-
-    do {
-        int sub_name_len = *label;
-        // (len + 1) since we are adding  a '.'
-        name_len += (sub_name_len + 1);
-        if (name_len > parsed_name_max_len) {
-            return NULL;
-        }
-
-        // Copy the sub name that follows the the label
-        memcpy(name_itr, label + 1, sub_name_len);
-        name_itr[sub_name_len] = '.';
-        name_itr += (sub_name_len + 1);
-        label += sub_name_len + 1;
-    } while (*label != 0);
-
-    // Terminate the final string, replacing the last '.'
-    parsed_name[name_len - 1] = '\0';
-    // Return pointer to first char after the name
-    return label + 1;
+/*
+    Walk the name in a question without copying it
+    returns the length of the wire name including the terminating zero label or -1
+*/
+static int parse_dns_name_len(const uint8_t *name, const uint8_t *end)
+{
+    const uint8_t *label = name;
+    while (label < end && *label != 0) {
+        // Compression pointers (and the reserved 0x40/0x80 types) don't appear in questions
+        if (*label > DNS_MAX_LABEL_LEN) {
+            return -1;
+        }
+        label += *label + 1;
+        // The limit includes the terminating zero label, which isn't counted yet
+        if (label - name >= DNS_MAX_NAME_LEN) {
+            return -1;
+        }
+    }
+    if (label >= end) {
+        return -1;
+    }
+    return label - name + 1;
 }
 
-// Parses the DNS request and prepares a DNS response with the IP of the softAP
-static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t dns_reply_max_len, dns_server_handle_t h)
+static int find_rule(dns_server_handle_t h, dns_rule_kind_t kind, const uint8_t *name, size_t len)
 {
-    if (req_len > dns_reply_max_len) {
+    if (h->num_of_rules == 0) {
         return -1;
     }
+    uint32_t hash = hash_name(name, len);
+    for (uint32_t i = hash & h->index_mask; h->index[i]; i = (i + 1) & h->index_mask) {
+        const dns_rule_t *rule = &h->rules[h->index[i] - 1];
+        if (rule->hash == hash && rule->kind == kind && rule->name_len == len && names_equal(rule->name, name, len)) {
+            return rule->entry;
+        }
+    }
+    return -1;
+}
+
+/*
+    Find the rule that answers the given wire format name. When more than one rule
+    matches, the one listed first in the config wins
+    returns the index of the matching entry or -1
+*/
+static int match_dns_name(dns_server_handle_t h, const uint8_t *name, size_t len)
+{
+    int best = h->match_all;
+    int entry = find_rule(h, RULE_EXACT, name, len);
+    if (entry >= 0 && (best < 0 || entry < best)) {
+        best = entry;
+    }
 
-    // Prepare the reply
-    memset(dns_reply, 0, dns_reply_max_len);
-    memcpy(dns_reply, req, req_len);
+    // Each proper suffix of the name, starting at a label boundary
+    for (size_t off = name[0] + 1; off < len - 1; off += name[off] + 1) {
+        entry = find_rule(h, RULE_SUFFIX, name + off, len - off);
+        if (entry >= 0 && (best < 0 || entry < best)) {
+            best = entry;
+        }
+    }
+    return best;
+}
+
+// Build the rule index from the configured entries
+static esp_err_t compile_rules(dns_server_handle_t h)
+{
+    h->match_all = -1;
+    h->rules = calloc(h->num_of_entries ? h->num_of_entries : 1, sizeof(dns_rule_t));
+    ESP_RETURN_ON_FALSE(h->rules, ESP_ERR_NO_MEM, TAG, "Failed to allocate dns rules");
+
+    uint32_t index_size = 8;
+    while (index_size < (uint32_t)h->num_of_entries * 2) {
+        index_size <<= 1;
+    }
+    h->index_mask = index_size - 1;
+    h->index = calloc(index_size, sizeof(uint16_t));
+    ESP_RETURN_ON_FALSE(h->index, ESP_ERR_NO_MEM, TAG, "Failed to allocate dns rule index");
+
+    for (int i = 0; i < h->num_of_entries; ++i) {
+        const dns_entry_pair_t *entry = &h->entry[i];
+
+        // Entries with neither an interface nor an IP can never answer
+        if (!entry->name || (!entry->if_key && entry->ip.addr == IPADDR_ANY)) {
+            continue;
+        }
+        if (strcmp(entry->name, "*") == 0) {
+            if (h->match_all < 0) {
+                h->match_all = i;
+            }
+            continue;
+        }
+
+        dns_rule_kind_t kind = RULE_EXACT;
+        const char *name = entry->name;
+        if (strncmp(name, "*.", 2) == 0) {
+            kind = RULE_SUFFIX;
+            name += 2;
+        }
+
+        uint8_t wire[DNS_MAX_NAME_LEN];
+        int len = compile_name(name, wire, sizeof(wire));
+        if (len < 0) {
+            ESP_LOGE(TAG, "Invalid DNS rule name: %s", entry->name);
+            continue;
+        }
+
+        // Lower entries already win a tie, so a duplicate name can be dropped
+        if (find_rule(h, kind, wire, len) >= 0) {
+            continue;
+        }
+
+        dns_rule_t *rule = &h->rules[h->num_of_rules];
+        rule->name = malloc(len);
+        ESP_RETURN_ON_FALSE(rule->name, ESP_ERR_NO_MEM, TAG, "Failed to allocate dns rule name");
+        memcpy(rule->name, wire, len);
+        rule->name_len = len;
+        rule->kind = kind;
+        rule->entry = i;
+        rule->hash = hash_name(wire, len);
+
+        uint32_t slot = rule->hash & h->index_mask;
+        while (h->index[slot]) {
+            slot = (slot + 1) & h->index_mask;
+        }
+        h->index[slot] = ++h->num_of_rules;
+    }
+    return ESP_OK;
+}
+
+/*
+    Look up the current IP of each entry's interface. Only called at start and on
+    IP events so answering a query never touches esp_netif
+*/
+static void refresh_if_addrs(dns_server_handle_t h)
+{
+    for (int i = 0; i < h->num_of_entries; ++i) {
+        if (!h->entry[i].if_key) {
+            continue;
+        }
+        uint32_t addr = IPADDR_ANY;
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey(h->entry[i].if_key);
+        esp_netif_ip_info_t ip_info;
+        if (netif && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
+            addr = ip_info.ip.addr;
+        }
+        atomic_store_explicit(&h->if_addr[i], addr, memory_order_relaxed);
+    }
+}
+
+static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    refresh_if_addrs(arg);
+}
+
+static void free_rules(dns_server_handle_t h)
+{
+    if (h->rules) {
+        for (int i = 0; i < h->num_of_rules; ++i) {
+            free(h->rules[i].name);
+        }
+        free(h->rules);
+    }
+    free(h->index);
+    free(h->if_addr);
+}
+
+/*
+    Parses the DNS request and turns it into a DNS response with the IP of the softAP,
+    in place. The header and question section are reused as is, any authority and
+    additional records (e.g. an EDNS OPT record) are dropped and the answers are
+    appended after the last question, pointing back at the question names. Since
+    the OPT record isn't echoed the reply is held to DNS_MAX_REPLY_LEN, with TC set
+    if the answers don't fit. Other
+    question types for a name we answer (e.g. AAAA or HTTPS) get an authoritative
+    NODATA, so clients stop waiting for them instead of timing out
+    returns the length of the reply, 0 if the request should be ignored or -1 if malformed
+*/
+static int parse_dns_request(char *buf, size_t req_len, size_t buf_max_len, dns_server_handle_t h)
+{
+    if (req_len < sizeof(dns_header_t)) {
+        return -1;
+    }
 
     // Endianess of NW packet different from chip
-    dns_header_t *header = (dns_header_t *)dns_reply;
+    dns_header_t *header = (dns_header_t *)buf;
     ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
              ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
 
@@ -117,59 +403,84 @@ static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t
         return 0;
     }
 
-    // Set question response flag
-    header->flags |= QR_FLAG;
-
+    // Find the end of the question section. Everything after it gets overwritten
     uint16_t qd_count = ntohs(header->qd_count);
-    header->an_count = htons(qd_count);
+    const uint8_t *end = (const uint8_t *)buf + req_len;
+    char *questions_end = buf + sizeof(dns_header_t);
+    for (int qd_i = 0; qd_i < qd_count; qd_i++) {
+        int name_len = parse_dns_name_len((const uint8_t *)questions_end, end);
+        if (name_len < 0 || (const uint8_t *)questions_end + name_len + sizeof(dns_question_t) > end) {
+            ESP_LOGD(TAG, "Failed to parse DNS question %d", qd_i);
+            return -1;
+        }
+        questions_end += name_len + sizeof(dns_question_t);
+    }
 
-    int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-    if (reply_len > dns_reply_max_len) {
-        return -1;
+    // Set question response flag
+    header->flags |= QR_FLAG;
+    header->ns_count = 0;
+    header->ar_count = 0;
+
+    char *reply_end = buf + MIN(buf_max_len, DNS_MAX_REPLY_LEN);
+    if (questions_end > reply_end) {
+        // Not even the questions fit, send back an empty truncated reply
+        header->flags |= TC_FLAG;
+        header->qd_count = 0;
+        header->an_count = 0;
+        return sizeof(dns_header_t);
     }
 
     // Pointer to current answer and question
-    char *cur_ans_ptr = dns_reply + req_len;
-    char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-    char name[128];
+    char *cur_ans_ptr = questions_end;
+    char *cur_qd_ptr = buf + sizeof(dns_header_t);
+    char *nodata_qd_ptr = NULL;
+    uint16_t an_count = 0;
 
     // Respond to all questions based on configured rules
     for (int qd_i = 0; qd_i < qd_count; qd_i++) {
-        char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-        if (name_end_ptr == NULL) {
-            ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
-            return -1;
-        }
-
-        dns_question_t *question = (dns_question_t *)(name_end_ptr);
+        int name_len = parse_dns_name_len((const uint8_t *)cur_qd_ptr, end);
+        char *qd_ptr = cur_qd_ptr;
+        dns_question_t *question = (dns_question_t *)(qd_ptr + name_len);
+        cur_qd_ptr += name_len + sizeof(dns_question_t);
         uint16_t qd_type = ntohs(question->type);
         uint16_t qd_class = ntohs(question->class);
 
-        ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type, qd_class, name);
+        ESP_LOGD(TAG, "Received type: %d | Class: %d", qd_type, qd_class);
+
+        // Check the configured rules to decide whether to answer this question or not
+        int i = match_dns_name(h, (const uint8_t *)qd_ptr, name_len);
+        if (i >= 0) {
+            header->flags |= AA_FLAG;
+        }
 
-        if (qd_type == QD_TYPE_A) {
+        if (qd_type != QD_TYPE_A) {
+            if (i >= 0 && !nodata_qd_ptr) {
+                nodata_qd_ptr = qd_ptr;
+            }
+        } else {
             esp_ip4_addr_t ip = { .addr = IPADDR_ANY };
-            // Check the configured rules to decide whether to answer this question or not
-            for (int i = 0; i < h->num_of_entries; ++i) {
-                // check if the name either corresponds to the entry, or if we should answer to all queries ("*")
-                if (strcmp(h->entry[i].name, "*") == 0 || strcmp(h->entry[i].name, name) == 0) {
-                    if (h->entry[i].if_key) {
-                        esp_netif_ip_info_t ip_info;
-                        esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey(h->entry[i].if_key), &ip_info);
-                        ip.addr = ip_info.ip.addr;
-                        break;
-                    } else if (h->entry->ip.addr != IPADDR_ANY) {
-                        ip.addr = h->entry[i].ip.addr;
-                        break;
-                    }
+            if (i >= 0) {
+                if (h->entry[i].if_key) {
+                    ip.addr = atomic_load_explicit(&h->if_addr[i], memory_order_relaxed);
+                } else {
+                    ip.addr = h->entry[i].ip.addr;
                 }
             }
             if (ip.addr == IPADDR_ANY) {    // no rule applies, continue with another question
                 continue;
             }
+
+            // Out of room, tell the client the answer is incomplete
+            if (cur_ans_ptr + sizeof(dns_answer_t) > reply_end) {
+                header->flags |= TC_FLAG;
+                break;
+            }
+
             dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
+            cur_ans_ptr += sizeof(dns_answer_t);
+            an_count++;
 
-            answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
+            answer->ptr_offset = htons(0xC000 | (qd_ptr - buf));
             answer->type = htons(qd_type);
             answer->class = htons(qd_class);
             answer->ttl = htonl(ANS_TTL_SEC);
@@ -180,90 +491,221 @@ static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t
             answer->ip_addr = ip.addr;
         }
     }
-    return reply_len;
+    header->an_count = htons(an_count);
+
+    // Nothing to answer but the name is ours, add the SOA that makes it a cacheable NODATA
+    if (an_count == 0 && nodata_qd_ptr && cur_ans_ptr + sizeof(dns_soa_t) > reply_end) {
+        header->flags |= TC_FLAG;
+    } else if (an_count == 0 && nodata_qd_ptr) {
+        dns_soa_t *soa = (dns_soa_t *)cur_ans_ptr;
+        cur_ans_ptr += sizeof(dns_soa_t);
+
+        soa->ptr_offset = htons(0xC000 | (nodata_qd_ptr - buf));
+        soa->type = htons(QD_TYPE_SOA);
+        soa->class = htons(1);
+        soa->ttl = htonl(DNS_SERVER_NODATA_TTL_SEC);
+        soa->data_len = htons(sizeof(dns_soa_t) - offsetof(dns_soa_t, mname));
+        soa->mname = 0;
+        soa->rname = 0;
+        soa->serial = htonl(1);
+        soa->refresh = htonl(DNS_SERVER_NODATA_TTL_SEC);
+        soa->retry = htonl(DNS_SERVER_NODATA_TTL_SEC);
+        soa->expire = htonl(DNS_SERVER_NODATA_TTL_SEC);
+        soa->minimum = htonl(DNS_SERVER_NODATA_TTL_SEC);
+        header->ns_count = htons(1);
+    }
+    return cur_ans_ptr - buf;
+}
+
+static inline void count(_Atomic uint32_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static void count_latency(dns_server_handle_t h, int64_t start_us)
+{
+    int64_t us = esp_timer_get_time() - start_us;
+    int bucket = 0;
+    for (int64_t limit = DNS_SERVER_LATENCY_BASE_US; bucket < DNS_SERVER_LATENCY_BUCKETS - 1 && us >= limit; limit <<= 1) {
+        bucket++;
+    }
+    count(&h->stats.latency[bucket]);
 }
 
 /*
-    Sets up a socket and listen for DNS queries,
-    replies to all type A queries with the IP of the softAP
+    Creates the non-blocking UDP socket for DNS queries
+    returns the socket or -1
 */
-void dns_server_task(void *pvParameters)
+static int open_dns_socket(void)
 {
-    char rx_buffer[128];
+    struct sockaddr_in dest_addr;
+    dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(DNS_PORT);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return -1;
+    }
+
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        ESP_LOGE(TAG, "Unable to make socket non-blocking: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+
+    if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+    ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
+    return sock;
+}
+
+/*
+    Answers every query waiting on the socket
+    returns false if the socket failed and needs to be recreated
+*/
+static bool handle_dns_packets(dns_server_handle_t handle, int sock, char *rx_buffer, size_t rx_buffer_len)
+{
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
     char addr_str[128];
-    int addr_family;
-    int ip_protocol;
-    dns_server_handle_t handle = pvParameters;
+#endif
 
-    while (handle->started) {
+    while (true) {
+        struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+        socklen_t socklen = sizeof(source_addr);
+        int len = recvfrom(sock, rx_buffer, rx_buffer_len, 0, (struct sockaddr *)&source_addr, &socklen);
 
-        struct sockaddr_in dest_addr;
-        dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(DNS_PORT);
-        addr_family = AF_INET;
-        ip_protocol = IPPROTO_IP;
-        inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+            return false;
+        }
 
-        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-            break;
+        int64_t start_us = esp_timer_get_time();
+        count(&handle->stats.queries);
+
+#if LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG
+        // Get the sender's ip address as string
+        if (source_addr.sin6_family == PF_INET) {
+            inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
+        } else if (source_addr.sin6_family == PF_INET6) {
+            inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
+        }
+        ESP_LOGD(TAG, "Received %d bytes from %s", len, addr_str);
+#endif
+
+        // The reply is built in place in rx_buffer
+        int reply_len = parse_dns_request(rx_buffer, len, rx_buffer_len, handle);
+        if (reply_len <= 0) {
+            count(&handle->stats.malformed);
+            continue;
         }
-        ESP_LOGI(TAG, "Socket created");
 
-        int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        if (err < 0) {
-            ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        dns_header_t *reply = (dns_header_t *)rx_buffer;
+        count(reply->an_count ? &handle->stats.answered : reply->ns_count ? &handle->stats.nodata : &handle->stats.unmatched);
+
+        // A failed send only loses this reply, the client will retry
+        if (sendto(sock, rx_buffer, reply_len, 0, (struct sockaddr *)&source_addr, socklen) < 0) {
+            count(&handle->stats.send_errors);
+            ESP_LOGD(TAG, "Error occurred during sending: errno %d", errno);
+            continue;
         }
-        ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
+        count_latency(handle, start_us);
+    }
+}
 
-        while (handle->started) {
-            ESP_LOGI(TAG, "Waiting for data");
-            struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-            socklen_t socklen = sizeof(source_addr);
-            int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+/*
+    Looks for a responder registered with the same socket, callback and argument
+    returns its index or -1
+*/
+static int find_responder(dns_server_handle_t handle, const dns_responder_t *responder)
+{
+    int found = -1;
+    xSemaphoreTake(handle->responders_lock, portMAX_DELAY);
+    for (int i = 0; i < handle->num_of_responders; ++i) {
+        const dns_responder_t *r = &handle->responders[i];
+        if (r->sock == responder->sock && r->cb == responder->cb && r->arg == responder->arg) {
+            found = i;
+            break;
+        }
+    }
+    xSemaphoreGive(handle->responders_lock);
+    return found;
+}
 
-            // Error occurred during receiving
-            if (len < 0) {
-                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                close(sock);
-                break;
-            }
-            // Data received
-            else {
-                // Get the sender's ip address as string
-                if (source_addr.sin6_family == PF_INET) {
-                    inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                } else if (source_addr.sin6_family == PF_INET6) {
-                    inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                }
+/*
+    Network task. Waits in select() on the non-blocking DNS socket and any added
+    responder sockets and replies to all type A queries with the IP of the softAP
+*/
+void dns_server_task(void *pvParameters)
+{
+    char rx_buffer[DNS_MAX_LEN];
+    dns_server_handle_t handle = pvParameters;
+    int sock = -1;
 
-                // Null-terminate whatever we received and treat like a string...
-                rx_buffer[len] = 0;
+    while (handle->started) {
+        if (sock < 0) {
+            sock = open_dns_socket();
+            if (sock < 0) {
+                vTaskDelay(pdMS_TO_TICKS(SOCKET_RETRY_MS));
+                continue;
+            }
+        }
 
-                char reply[DNS_MAX_LEN];
-                int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN, handle);
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(sock, &read_fds);
+        int max_fd = sock;
+
+        // Work from a copy, callbacks may add and remove responders
+        dns_responder_t responders[DNS_SERVER_MAX_RESPONDERS];
+        xSemaphoreTake(handle->responders_lock, portMAX_DELAY);
+        int num_of_responders = handle->num_of_responders;
+        memcpy(responders, handle->responders, num_of_responders * sizeof(dns_responder_t));
+        xSemaphoreGive(handle->responders_lock);
+        for (int i = 0; i < num_of_responders; ++i) {
+            FD_SET(responders[i].sock, &read_fds);
+            max_fd = MAX(max_fd, responders[i].sock);
+        }
 
-                ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
-                if (reply_len <= 0) {
-                    ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-                } else {
-                    int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                    if (err < 0) {
-                        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                        break;
-                    }
-                }
+        // Time out now and then to see if we've been stopped
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = SELECT_TIMEOUT_MS * 1000 };
+        int ready = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            close(sock);
+            sock = -1;
+            vTaskDelay(pdMS_TO_TICKS(SOCKET_RETRY_MS));
+            continue;
         }
 
-        if (sock != -1) {
-            ESP_LOGE(TAG, "Shutting down socket");
-            shutdown(sock, 0);
+        if (FD_ISSET(sock, &read_fds) && !handle_dns_packets(handle, sock, rx_buffer, sizeof(rx_buffer))) {
             close(sock);
+            sock = -1;
+        }
+
+        for (int i = 0; i < num_of_responders; ++i) {
+            // Skip any an earlier callback removed
+            if (FD_ISSET(responders[i].sock, &read_fds) && find_responder(handle, &responders[i]) >= 0) {
+                responders[i].cb(responders[i].sock, responders[i].arg);
+            }
         }
     }
+
+    if (sock >= 0) {
+        ESP_LOGI(TAG, "Shutting down socket");
+        close(sock);
+    }
+    handle->running = false;
     vTaskDelete(NULL);
 }
 
@@ -272,19 +714,132 @@ dns_server_handle_t start_dns_server(dns_server_config_t *config)
     dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle) + config->num_of_entries * sizeof(dns_entry_pair_t));
     ESP_RETURN_ON_FALSE(handle, NULL, TAG, "Failed to allocate dns server handle");
 
+    handle->responders_lock = xSemaphoreCreateMutex();
+    if (!handle->responders_lock) {
+        ESP_LOGE(TAG, "Failed to create responders lock");
+        free(handle);
+        return NULL;
+    }
+
     handle->started = true;
     handle->num_of_entries = config->num_of_entries;
     memcpy(handle->entry, config->item, config->num_of_entries * sizeof(dns_entry_pair_t));
 
-    xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task);
+    handle->if_addr = calloc(handle->num_of_entries ? handle->num_of_entries : 1, sizeof(*handle->if_addr));
+    if (!handle->if_addr || compile_rules(handle) != ESP_OK) {
+        vSemaphoreDelete(handle->responders_lock);
+        free_rules(handle);
+        free(handle);
+        return NULL;
+    }
+
+    refresh_if_addrs(handle);
+    if (esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, ip_event_handler, handle, &handle->ip_event) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register for IP events, interface addresses will not be refreshed");
+    }
+
+    handle->running = true;
+    if (xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create dns server task");
+        esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, handle->ip_event);
+        vSemaphoreDelete(handle->responders_lock);
+        free_rules(handle);
+        free(handle);
+        return NULL;
+    }
     return handle;
 }
 
-void stop_dns_server(dns_server_handle_t handle)
+esp_err_t dns_server_add_responder(dns_server_handle_t handle, int sock, dns_server_responder_cb_t cb, void *arg)
+{
+    ESP_RETURN_ON_FALSE(handle && sock >= 0 && cb, ESP_ERR_INVALID_ARG, TAG, "Invalid argument");
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    xSemaphoreTake(handle->responders_lock, portMAX_DELAY);
+    if (handle->num_of_responders < DNS_SERVER_MAX_RESPONDERS) {
+        handle->responders[handle->num_of_responders++] = (dns_responder_t) { .sock = sock, .cb = cb, .arg = arg };
+        err = ESP_OK;
+    }
+    xSemaphoreGive(handle->responders_lock);
+    ESP_RETURN_ON_FALSE(err == ESP_OK, err, TAG, "Too many responders");
+    return ESP_OK;
+}
+
+esp_err_t dns_server_remove_responder(dns_server_handle_t handle, int sock)
+{
+    ESP_RETURN_ON_FALSE(handle && sock >= 0, ESP_ERR_INVALID_ARG, TAG, "Invalid argument");
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(handle->responders_lock, portMAX_DELAY);
+    for (int i = 0; i < handle->num_of_responders; ++i) {
+        if (handle->responders[i].sock == sock) {
+            handle->responders[i] = handle->responders[--handle->num_of_responders];
+            err = ESP_OK;
+            break;
+        }
+    }
+    xSemaphoreGive(handle->responders_lock);
+    return err;
+}
+
+esp_err_t dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(handle && stats, ESP_ERR_INVALID_ARG, TAG, "Invalid argument");
+
+    stats->queries = atomic_load_explicit(&handle->stats.queries, memory_order_relaxed);
+    stats->answered = atomic_load_explicit(&handle->stats.answered, memory_order_relaxed);
+    stats->unmatched = atomic_load_explicit(&handle->stats.unmatched, memory_order_relaxed);
+    stats->nodata = atomic_load_explicit(&handle->stats.nodata, memory_order_relaxed);
+    stats->malformed = atomic_load_explicit(&handle->stats.malformed, memory_order_relaxed);
+    stats->send_errors = atomic_load_explicit(&handle->stats.send_errors, memory_order_relaxed);
+    for (int i = 0; i < DNS_SERVER_LATENCY_BUCKETS; ++i) {
+        stats->latency[i] = atomic_load_explicit(&handle->stats.latency[i], memory_order_relaxed);
+    }
+    return ESP_OK;
+}
+
+const char *dns_server_probe_response(const char *request, size_t request_len, size_t *response_len)
+{
+    // Only the request line matters: "GET /path[?query] HTTP/1.1"
+    if (request_len < 5 || memcmp(request, "GET /", 5) != 0) {
+        return NULL;
+    }
+    const char *path = request + 4;
+    size_t path_len = 0;
+    while (4 + path_len < request_len && path[path_len] != ' ' && path[path_len] != '?' && path[path_len] != '\r') {
+        path_len++;
+    }
+
+    for (size_t i = 0; i < sizeof(probe_paths) / sizeof(probe_paths[0]); ++i) {
+        if (strlen(probe_paths[i]) == path_len && memcmp(probe_paths[i], path, path_len) == 0) {
+            if (response_len) {
+                *response_len = sizeof(probe_redirect) - 1;
+            }
+            return probe_redirect;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t stop_dns_server(dns_server_handle_t handle)
 {
     if (handle) {
+        // Waiting for the task to exit from the task itself would never return
+        ESP_RETURN_ON_FALSE(xTaskGetCurrentTaskHandle() != handle->task, ESP_ERR_INVALID_STATE, TAG,
+                            "Can't stop the DNS server from its own task (e.g. a responder callback)");
+
         handle->started = false;
-        vTaskDelete(handle->task);
+        if (handle->ip_event) {
+            esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, handle->ip_event);
+        }
+
+        // The task sees this within SELECT_TIMEOUT_MS, closes its socket and exits
+        while (handle->running) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+        vSemaphoreDelete(handle->responders_lock);
+        free_rules(handle);
         free(handle);
     }
+    return ESP_OK;
 }
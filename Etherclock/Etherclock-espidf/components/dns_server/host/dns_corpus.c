@@ -0,0 +1,462 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Replays a corpus of awkward DNS packets (truncated, overlong names,
+// multi-question, EDNS with the AD bit, oversized) against dns_server_host
+// started with no rules (so every A question is answered) and checks each
+// reply, or that there isn't one. After every packet a plain A query is sent as a sentinel: the
+// server answers in order, so once the sentinel's reply is in, anything the
+// case was going to get has arrived too.
+//
+//      dns_corpus [-s server] [-p port]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_PORT (5353)
+#define REPLY_TIMEOUT_MS (1000)
+#define MAX_PACKET_LEN (1500)
+#define MAX_UDP_REPLY_LEN (512)     // No OPT in the reply, so plain DNS over UDP
+
+#define CASE_ID (0x1234)
+#define SENTINEL_ID (0xbeef)
+
+#define QD_TYPE_A (1)
+#define QD_TYPE_SOA (6)
+#define QD_TYPE_AAAA (28)
+#define QD_TYPE_OPT (41)
+
+#define QR_FLAG (0x8000)
+#define AA_FLAG (0x0400)
+#define TC_FLAG (0x0200)
+#define RD_FLAG (0x0100)
+#define AD_FLAG (0x0020)
+
+#define HEADER_LEN (12)
+#define ANSWER_LEN (16)     // Compressed name, type, class, TTL, length, IPv4
+
+typedef struct {
+    uint8_t data[MAX_PACKET_LEN];
+    int len;
+} packet_t;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+static void start_query(packet_t *packet, uint16_t id, uint16_t flags)
+{
+    memset(packet->data, 0, HEADER_LEN);
+    put16(packet->data, id);
+    put16(packet->data + 2, flags);
+    packet->len = HEADER_LEN;
+}
+
+static void add_question(packet_t *packet, const char *name, uint16_t type)
+{
+    uint8_t *buf = packet->data;
+    int len = packet->len;
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        int label_len = dot ? (int)(dot - name) : (int)strlen(name);
+        buf[len++] = label_len;
+        memcpy(buf + len, name, label_len);
+        len += label_len;
+        name += label_len + (dot ? 1 : 0);
+    }
+    buf[len++] = 0;
+    put16(buf + len, type);
+    put16(buf + len + 2, 1);  // Class IN
+    packet->len = len + 4;
+    put16(buf + 4, get16(buf + 4) + 1);
+}
+
+// Question for a name of wire_len octets, terminating zero label included,
+// made of 63 octet labels and whatever is left over
+static void add_long_question(packet_t *packet, int wire_len, uint16_t type)
+{
+    uint8_t *buf = packet->data;
+    int len = packet->len;
+    int remaining = wire_len - 1;
+    while (remaining > 0) {
+        int label_len = remaining - 1 < 63 ? remaining - 1 : 63;
+        buf[len++] = label_len;
+        memset(buf + len, 'a', label_len);
+        len += label_len;
+        remaining -= label_len + 1;
+    }
+    buf[len++] = 0;
+    put16(buf + len, type);
+    put16(buf + len + 2, 1);  // Class IN
+    packet->len = len + 4;
+    put16(buf + 4, get16(buf + 4) + 1);
+}
+
+// EDNS OPT pseudo record advertising a 1232 byte payload, with the DO bit set
+static void add_opt(packet_t *packet)
+{
+    uint8_t *p = packet->data + packet->len;
+    p[0] = 0;                   // Root name
+    put16(p + 1, QD_TYPE_OPT);
+    put16(p + 3, 1232);         // UDP payload size
+    p[5] = 0;                   // Extended RCODE
+    p[6] = 0;                   // Version
+    put16(p + 7, 0x8000);       // DO
+    put16(p + 9, 0);            // No options
+    packet->len += 11;
+    put16(packet->data + 10, get16(packet->data + 10) + 1);
+}
+
+// Fails unless the reply is a well formed answer to qd_count questions with
+// an_count answers appended straight after them
+static const char *check_answers(const packet_t *query, const packet_t *reply, int qd_count, int an_count)
+{
+    uint16_t flags = get16(reply->data + 2);
+    if (!(flags & QR_FLAG)) {
+        return "QR not set";
+    }
+    if (flags & TC_FLAG) {
+        return "TC set";
+    }
+    if (get16(reply->data + 4) != qd_count || get16(reply->data + 6) != an_count) {
+        return "wrong question or answer count";
+    }
+    if (get16(reply->data + 8) != 0 || get16(reply->data + 10) != 0) {
+        return "authority or additional records in an answer";
+    }
+    if (reply->len > MAX_UDP_REPLY_LEN) {
+        return "reply over 512 bytes";
+    }
+
+    // The questions come back as sent, OPT record (if any) dropped
+    int questions_len = query->len - HEADER_LEN;
+    if (get16(query->data + 10)) {
+        questions_len -= 11;
+    }
+    if (reply->len != HEADER_LEN + questions_len + an_count * ANSWER_LEN) {
+        return "reply length doesn't match the answer count";
+    }
+    if (memcmp(reply->data + HEADER_LEN, query->data + HEADER_LEN, questions_len) != 0) {
+        return "questions not echoed";
+    }
+    return NULL;
+}
+
+// Cases. Each builds its query and checks the reply, reply is NULL if there wasn't one
+
+static const char *single_a(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "captive.apple.com", QD_TYPE_A);
+        return NULL;
+    }
+    return check_answers(query, reply, 1, 1);
+}
+
+static const char *header_only(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        query->len = HEADER_LEN - 1;
+        return NULL;
+    }
+    return "short packet answered";
+}
+
+static const char *name_runs_off_end(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "captive.apple.com", QD_TYPE_A);
+        query->len -= 8;
+        return NULL;
+    }
+    return "truncated question answered";
+}
+
+static const char *missing_question(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "captive.apple.com", QD_TYPE_A);
+        put16(query->data + 4, 2);
+        return NULL;
+    }
+    return "qd_count past the end answered";
+}
+
+static const char *compression_pointer(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "apple.com", QD_TYPE_A);
+        // Second question "captive" + pointer back to the first name
+        uint8_t *p = query->data + query->len;
+        memcpy(p, "\x07" "captive", 8);
+        put16(p + 8, 0xc000 | HEADER_LEN);
+        put16(p + 10, QD_TYPE_A);
+        put16(p + 12, 1);
+        query->len += 14;
+        put16(query->data + 4, 2);
+        return NULL;
+    }
+    return "compressed question answered";
+}
+
+// RFC 1035 caps a name at 255 octets, terminating zero label included
+static const char *longest_name(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_long_question(query, 255, QD_TYPE_A);
+        return NULL;
+    }
+    return check_answers(query, reply, 1, 1);
+}
+
+static const char *name_too_long(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_long_question(query, 256, QD_TYPE_A);
+        return NULL;
+    }
+    return "256 octet name answered";
+}
+
+static const char *not_a_query(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, 0x2000);  // Opcode 4, NOTIFY
+        add_question(query, "captive.apple.com", QD_TYPE_A);
+        return NULL;
+    }
+    return "NOTIFY answered";
+}
+
+static const char *multi_question(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "captive.apple.com", QD_TYPE_A);
+        add_question(query, "captive.apple.com", QD_TYPE_AAAA);
+        add_question(query, "connectivitycheck.gstatic.com", QD_TYPE_A);
+        return NULL;
+    }
+    return check_answers(query, reply, 3, 2);
+}
+
+static const char *edns_with_ad(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG | AD_FLAG);
+        add_question(query, "www.msftconnecttest.com", QD_TYPE_A);
+        add_opt(query);
+        return NULL;
+    }
+    return check_answers(query, reply, 1, 1);
+}
+
+static const char *aaaa_nodata(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        add_question(query, "captive.apple.com", QD_TYPE_AAAA);
+        return NULL;
+    }
+
+    uint16_t flags = get16(reply->data + 2);
+    if ((flags & (QR_FLAG | AA_FLAG | TC_FLAG)) != (QR_FLAG | AA_FLAG)) {
+        return "NODATA flags not QR+AA";
+    }
+    if (get16(reply->data + 6) != 0 || get16(reply->data + 8) != 1) {
+        return "NODATA without exactly one authority record";
+    }
+    // Authority record is the SOA, right after the question, owner compressed
+    const uint8_t *soa = reply->data + query->len;
+    if (reply->len < query->len + 12 || get16(soa + 2) != QD_TYPE_SOA) {
+        return "authority record isn't an SOA";
+    }
+    return NULL;
+}
+
+// Enough A questions to overflow 512 bytes of answers, but not 512 bytes of questions
+static const char *answers_overflow(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        for (int i = 0; i < 30; ++i) {
+            add_question(query, "ab.cd", QD_TYPE_A);     // 342 bytes in all
+        }
+        return NULL;
+    }
+
+    uint16_t flags = get16(reply->data + 2);
+    int an_count = get16(reply->data + 6);
+    if (!(flags & TC_FLAG)) {
+        return "TC not set";
+    }
+    if (reply->len > MAX_UDP_REPLY_LEN) {
+        return "reply over 512 bytes";
+    }
+    if (an_count == 0 || reply->len != query->len + an_count * ANSWER_LEN) {
+        return "reply length doesn't match the answer count";
+    }
+    return NULL;
+}
+
+// An EDNS sized query whose questions alone are over 512 bytes
+static const char *questions_overflow(packet_t *query, const packet_t *reply)
+{
+    if (!reply) {
+        start_query(query, CASE_ID, RD_FLAG);
+        for (int i = 0; i < 12; ++i) {
+            add_question(query, "a-rather-long-label-to-fill-things-up.portal.example.com", QD_TYPE_A);
+        }
+        add_opt(query);
+        return NULL;
+    }
+
+    if (!(get16(reply->data + 2) & TC_FLAG)) {
+        return "TC not set";
+    }
+    if (reply->len > MAX_UDP_REPLY_LEN) {
+        return "reply over 512 bytes";
+    }
+    return NULL;
+}
+
+typedef const char *(*case_fn_t)(packet_t *query, const packet_t *reply);
+
+static const struct {
+    const char *name;
+    case_fn_t fn;
+    bool expect_reply;
+} cases[] = {
+    { "single A",               single_a,               true },
+    { "header only",            header_only,            false },
+    { "name runs off end",      name_runs_off_end,      false },
+    { "missing question",       missing_question,       false },
+    { "compression pointer",    compression_pointer,    false },
+    { "longest name",           longest_name,           true },
+    { "name too long",          name_too_long,          false },
+    { "not a query",            not_a_query,            false },
+    { "multi question",         multi_question,         true },
+    { "EDNS with AD",           edns_with_ad,           true },
+    { "AAAA NODATA",            aaaa_nodata,            true },
+    { "answers overflow",       answers_overflow,       true },
+    { "questions overflow",     questions_overflow,     true },
+};
+
+#define NUM_CASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+// Sends the case and the sentinel, returns false if the sentinel never came back
+static bool exchange(int sock, const packet_t *query, packet_t *reply, bool *got_reply)
+{
+    packet_t sentinel;
+    start_query(&sentinel, SENTINEL_ID, RD_FLAG);
+    add_question(&sentinel, "sentinel.example.com", QD_TYPE_A);
+
+    send(sock, query->data, query->len, 0);
+    send(sock, sentinel.data, sentinel.len, 0);
+
+    *got_reply = false;
+    while (true) {
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) {
+            return false;
+        }
+        packet_t received;
+        received.len = recv(sock, received.data, sizeof(received.data), 0);
+        if (received.len < 2) {
+            continue;
+        }
+        uint16_t id = get16(received.data);
+        if (id == SENTINEL_ID) {
+            return true;
+        }
+        if (id == CASE_ID) {
+            *reply = received;
+            *got_reply = true;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = "127.0.0.1";
+    int port = DEFAULT_PORT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-s server] [-p port]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, server, &addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid server address '%s'\n", server);
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = 0; i < NUM_CASES; ++i) {
+        packet_t query;
+        packet_t reply;
+        bool got_reply;
+        cases[i].fn(&query, NULL);
+
+        const char *error = NULL;
+        if (!exchange(sock, &query, &reply, &got_reply)) {
+            error = "no reply to the sentinel";
+        } else if (got_reply) {
+            error = cases[i].fn(&query, &reply);
+        } else if (cases[i].expect_reply) {
+            error = "no reply";
+        }
+
+        printf("%-22s %s\n", cases[i].name, error ? error : "ok");
+        if (error) {
+            failures++;
+        }
+    }
+
+    close(sock);
+    printf("%d of %d failed\n", failures, NUM_CASES);
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,282 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Runs the captive portal DNS server on the host. DNS is served on DNS_PORT
+// (set by the build) and a minimal portal HTTP responder shares the same
+// network task on the given HTTP port. Connectivity check probes get the
+// server's canned redirect and anything else gets a stand-in portal page.
+// Accepted connections are served from the same select() as DNS, so a slow
+// or idle client never holds up a DNS reply. Press ^C to stop and print the
+// server's counters.
+//
+//      dns_server_host [-h http_port] [-r count] [rule ...]
+//
+// A rule is "name=a.b.c.d" to answer with a fixed address or just "name" to
+// answer with the (stubbed, loopback) interface address. Names can be "*" or
+// "*.suffix". -r adds count generated rules (see dns_bench_rules.h) ahead of
+// those, for benchmarking with dns_loadgen -r. With no rules every name is
+// answered with 127.0.0.1.
+
+#define DNS_SERVER_MAX_ITEMS 1024
+
+#include "dns_server_port.h"
+#include "dns_server.h"
+#include "dns_bench_rules.h"
+
+#include <inttypes.h>
+#include <signal.h>
+
+#define DEFAULT_HTTP_PORT (8080)
+#define HTTP_MAX_CONNECTIONS (DNS_SERVER_MAX_RESPONDERS - 1)  // One responder is the listening socket
+#define HTTP_IDLE_TIMEOUT_MS (2000)
+
+typedef struct {
+    int sock;               // -1 if the slot is free
+    int64_t accepted_us;
+} http_connection_t;
+
+static const char *TAG = "dns_server_host";
+
+_Atomic uint32_t host_netif_lookups;
+
+static volatile sig_atomic_t stop_requested;
+
+static dns_server_handle_t server;
+
+// Only touched from responder callbacks, so only on the DNS server's network task
+static http_connection_t connections[HTTP_MAX_CONNECTIONS];
+
+static const char portal_page[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 32\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<html><body>Portal</body></html>";
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void close_connection(http_connection_t *conn)
+{
+    dns_server_remove_responder(server, conn->sock);
+    close(conn->sock);
+    conn->sock = -1;
+}
+
+// Returns a free slot, dropping idle connections and if need be the oldest one
+static http_connection_t *free_connection(void)
+{
+    int64_t now = esp_timer_get_time();
+    http_connection_t *free_conn = NULL;
+    http_connection_t *oldest = NULL;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i) {
+        http_connection_t *conn = &connections[i];
+        if (conn->sock >= 0 && now - conn->accepted_us > HTTP_IDLE_TIMEOUT_MS * 1000) {
+            close_connection(conn);
+        }
+        if (conn->sock < 0) {
+            free_conn = free_conn ? free_conn : conn;
+        } else if (!oldest || conn->accepted_us < oldest->accepted_us) {
+            oldest = conn;
+        }
+    }
+    if (!free_conn && oldest) {
+        close_connection(oldest);
+        free_conn = oldest;
+    }
+    return free_conn;
+}
+
+// Called on the DNS server's network task when a connection is readable. The
+// request line arrives in the first segment, so one read decides the reply
+static void http_connection_responder(int sock, void *arg)
+{
+    http_connection_t *conn = arg;
+
+    char request[512];
+    int len = recv(sock, request, sizeof(request), MSG_DONTWAIT);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+
+    if (len > 0) {
+        size_t reply_len = 0;
+        const char *reply = dns_server_probe_response(request, len, &reply_len);
+        if (!reply) {
+            reply = portal_page;
+            reply_len = sizeof(portal_page) - 1;
+        }
+        // Small enough to always fit the empty send buffer of a new connection
+        send(sock, reply, reply_len, MSG_DONTWAIT);
+    }
+    close_connection(conn);
+}
+
+// Called on the DNS server's network task when the listening socket is readable
+static void http_listen_responder(int listen_sock, void *arg)
+{
+    (void)arg;
+
+    while (true) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            return;
+        }
+
+        // Accepted sockets don't inherit O_NONBLOCK on Linux
+        http_connection_t *conn = free_connection();
+        if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0 ||
+                dns_server_add_responder(server, sock, http_connection_responder, conn) != ESP_OK) {
+            close(sock);
+            continue;
+        }
+        conn->sock = sock;
+        conn->accepted_us = esp_timer_get_time();
+    }
+}
+
+static int open_http_socket(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0 ||
+            fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static bool add_bench_rules(dns_server_config_t *config, int count)
+{
+    if (count < 0 || count > BENCH_MAX_RULES || config->num_of_entries + count > DNS_SERVER_MAX_ITEMS) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        char name[64];
+        bench_rule_name(name, sizeof(name), i);
+        dns_entry_pair_t *entry = &config->item[config->num_of_entries++];
+        entry->name = strdup(name);
+        entry->ip.addr = bench_rule_addr(i);
+    }
+    return true;
+}
+
+static bool parse_rule(char *arg, dns_entry_pair_t *entry)
+{
+    char *ip = strchr(arg, '=');
+    entry->name = arg;
+    if (!ip) {
+        entry->if_key = "WIFI_AP_DEF";
+        return true;
+    }
+
+    *ip++ = '\0';
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip, &addr) != 1) {
+        return false;
+    }
+    entry->ip.addr = addr.s_addr;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static dns_server_config_t config;
+    int http_port = DEFAULT_HTTP_PORT;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            http_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc && add_bench_rules(&config, atoi(argv[i + 1]))) {
+            i++;
+        } else if (config.num_of_entries < DNS_SERVER_MAX_ITEMS && parse_rule(argv[i], &config.item[config.num_of_entries])) {
+            config.num_of_entries++;
+        } else {
+            fprintf(stderr, "usage: %s [-h http_port] [-r count] [name[=a.b.c.d] ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.num_of_entries == 0) {
+        config.item[0] = (dns_entry_pair_t) { .name = "*", .ip = { .addr = ESP_IP4TOADDR(127, 0, 0, 1) } };
+        config.num_of_entries = 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i) {
+        connections[i].sock = -1;
+    }
+
+    dns_server_handle_t handle = start_dns_server(&config);
+    server = handle;
+    if (!handle) {
+        ESP_LOGE(TAG, "Failed to start DNS server");
+        return 1;
+    }
+
+    int http_sock = open_http_socket(http_port);
+    if (http_sock < 0 || dns_server_add_responder(handle, http_sock, http_listen_responder, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start HTTP responder on port %d", http_port);
+    } else {
+        ESP_LOGI(TAG, "HTTP responder on port %d", http_port);
+    }
+    ESP_LOGI(TAG, "DNS on port %d with %d rules, ^C to stop", DNS_PORT, config.num_of_entries);
+
+    uint32_t startup_lookups = atomic_load(&host_netif_lookups);
+    while (!stop_requested) {
+        pause();
+    }
+
+    dns_server_stats_t stats;
+    dns_server_get_stats(handle, &stats);
+    stop_dns_server(handle);
+    if (http_sock >= 0) {
+        close(http_sock);
+    }
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; ++i) {
+        if (connections[i].sock >= 0) {
+            close(connections[i].sock);
+        }
+    }
+
+    printf("queries      %" PRIu32 "\n", stats.queries);
+    printf("answered     %" PRIu32 "\n", stats.answered);
+    printf("unmatched    %" PRIu32 "\n", stats.unmatched);
+    printf("nodata       %" PRIu32 "\n", stats.nodata);
+    printf("malformed    %" PRIu32 "\n", stats.malformed);
+    printf("send errors  %" PRIu32 "\n", stats.send_errors);
+    printf("netif calls  %" PRIu32 " after startup\n", atomic_load(&host_netif_lookups) - startup_lookups);
+    printf("latency\n");
+    for (int i = 0, limit = DNS_SERVER_LATENCY_BASE_US; i < DNS_SERVER_LATENCY_BUCKETS; ++i, limit <<= 1) {
+        if (i < DNS_SERVER_LATENCY_BUCKETS - 1) {
+            printf("    < %6dus %" PRIu32 "\n", limit, stats.latency[i]);
+        } else {
+            printf("   >= %6dus %" PRIu32 "\n", limit >> 1, stats.latency[i]);
+        }
+    }
+    return 0;
+}
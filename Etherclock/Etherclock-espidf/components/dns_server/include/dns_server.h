@@ -14,6 +14,18 @@ extern "C" {
 #define DNS_SERVER_MAX_ITEMS 1
 #endif
 
+#ifndef DNS_SERVER_MAX_RESPONDERS
+#define DNS_SERVER_MAX_RESPONDERS 4
+#endif
+
+#define DNS_SERVER_LATENCY_BUCKETS 8
+#define DNS_SERVER_LATENCY_BASE_US 50
+#define DNS_SERVER_NODATA_TTL_SEC 300     // How long clients may cache "no AAAA/HTTPS records for this name"
+
+#ifndef DNS_SERVER_PORTAL_URL
+#define DNS_SERVER_PORTAL_URL "http://192.168.4.1/"
+#endif
+
 #define DNS_SERVER_CONFIG_SINGLE(queried_name, netif_key)  {        \
         .num_of_entries = 1,                                        \
         .item = { { .name = queried_name, .if_key = netif_key } }   \
@@ -26,7 +38,7 @@ extern "C" {
  * we don't take copies of the config values `name` and `if_key`
  */
 typedef struct dns_entry_pair {
-    const char* name;       /**<! Exact match of the name field of the DNS query to answer */
+    const char* name;       /**<! Name to answer: exact match (case insensitive), "*.suffix" for any name below suffix, or "*" for all */
     const char* if_key;     /**<! Use this network interface IP to answer, only if NULL, use the static IP below */
     esp_ip4_addr_t ip;      /**<! Constant IP address to answer this query, if "if_key==NULL" */
 } dns_entry_pair_t;
@@ -57,10 +69,30 @@ typedef struct dns_server_config {
  */
 typedef struct dns_server_handle *dns_server_handle_t;
 
+/**
+ * @brief DNS server counters, all counting since the server was started
+ *
+ * @note Reply latency is measured from receiving a query to sending its reply. Bucket 0 counts
+ * replies under DNS_SERVER_LATENCY_BASE_US, each bucket after that doubles the limit and the last
+ * one counts the rest
+ */
+typedef struct dns_server_stats {
+    uint32_t queries;       /**<! Packets received */
+    uint32_t answered;      /**<! Replies with at least one answer */
+    uint32_t unmatched;     /**<! Replies with no answer because no rule matched */
+    uint32_t nodata;        /**<! NODATA replies for a name that matched but wasn't an A question (e.g. AAAA or HTTPS) */
+    uint32_t malformed;     /**<! Packets that could not be parsed or were not a standard query */
+    uint32_t send_errors;   /**<! Replies that failed to send */
+    uint32_t latency[DNS_SERVER_LATENCY_BUCKETS];   /**<! Reply latency histogram */
+} dns_server_stats_t;
+
 /**
  * @brief Set ups and starts a simple DNS server that will respond to all A queries (IPv4)
  * based on configured rules, pairs of name and either IPv4 address or a netif ID (to respond by it's IPv4 add)
  *
+ * @note The rules are compiled into a hashed index when the server starts. When more than one
+ * rule matches a query, the one listed first in the config is used
+ *
  * @param config Configuration structure listing the pairs of (name, IP/netif-id)
  * @return dns_server's handle on success, NULL on failure
  */
@@ -68,9 +100,73 @@ dns_server_handle_t start_dns_server(dns_server_config_t *config);
 
 /**
  * @brief Stops and destroys DNS server's task and structs
+ *
+ * @note Blocks until the network task has exited. That normally takes up to 500ms (the task's
+ * select() timeout), or up to a second while the task is waiting to recreate a failed socket.
+ * It can't be called from the network task itself, so not from a responder callback
+ *
  * @param handle DNS server's handle to destroy
+ * @return ESP_OK on success (or if handle is NULL), ESP_ERR_INVALID_STATE if called from the
+ * DNS server's own task, in which case nothing is stopped
+ */
+esp_err_t stop_dns_server(dns_server_handle_t handle);
+
+/**
+ * @brief Callback for a responder socket, called from the DNS server's network task when the
+ * socket is readable. It must not block, DNS replies wait while it runs. A responder serving
+ * connections should add each accepted (non-blocking) socket as a responder of its own and
+ * remove it when done, rather than waiting for the request to arrive
+ */
+typedef void (*dns_server_responder_cb_t)(int sock, void *arg);
+
+/**
+ * @brief Adds a socket (e.g. a listening TCP socket for a lightweight HTTP responder) to be
+ * served by the DNS server's network task, so it doesn't need a task of its own
+ *
+ * @note The socket should be non-blocking. It stays owned by the caller and must stay open until
+ * it is removed or the server is stopped. Can be called from any task, including responder callbacks
+ *
+ * @param handle DNS server's handle
+ * @param sock Socket to wait on
+ * @param cb Called when the socket is readable
+ * @param arg Passed to the callback
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if DNS_SERVER_MAX_RESPONDERS are already added
+ */
+esp_err_t dns_server_add_responder(dns_server_handle_t handle, int sock, dns_server_responder_cb_t cb, void *arg);
+
+/**
+ * @brief Removes a socket added with dns_server_add_responder(). Its callback isn't called again
+ * once this returns, so the caller can then close the socket
+ *
+ * @note Can be called from any task, including responder callbacks (e.g. the socket's own)
+ *
+ * @param handle DNS server's handle
+ * @param sock Socket to remove
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the socket isn't a responder
+ */
+esp_err_t dns_server_remove_responder(dns_server_handle_t handle, int sock);
+
+/**
+ * @brief Gets a snapshot of the DNS server's counters
+ * @param handle DNS server's handle
+ * @param stats Filled in with the current counters
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if either argument is NULL
+ */
+esp_err_t dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats);
+
+/**
+ * @brief Looks up the canned reply for an OS connectivity check (captive portal probe) request,
+ * e.g. Android's /generate_204, Apple's /hotspot-detect.html or Windows' /connecttest.txt
+ *
+ * @note The reply is a constant 302 redirect to DNS_SERVER_PORTAL_URL, kept in flash, which makes
+ * the client open the portal straight away. Send it as is and close the connection
+ *
+ * @param request Start of the HTTP request, at least the request line
+ * @param request_len Number of bytes in request
+ * @param response_len Set to the length of the reply, if not NULL
+ * @return The reply, or NULL if the request isn't a known probe and should be served normally
  */
-void stop_dns_server(dns_server_handle_t handle);
+const char *dns_server_probe_response(const char *request, size_t request_len, size_t *response_len);
 
 
 #ifdef __cplusplus
@@ -30,20 +30,91 @@
 
 #include "IDFWiFiPortal.h"
 
+#include "esp_pm.h"
+#include "esp_timer.h"
+
 mil::IDFWiFiPortal portal;
 
 static const char* TAG = "Etherclock";
 
+// The display is latched and only changes once a minute, so the loop doesn't
+// need to run every tick. Blocking longer than CONFIG_FREERTOS_IDLE_TIME_BEFORE_SLEEP
+// lets tickless idle put the chip into light sleep between passes. 50ms is
+// still fast enough for button polling.
+static constexpr uint32_t LoopPeriodMs = 50;
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS || CONFIG_ETHERCLOCK_PM_LOCK_REPORT
+static constexpr int64_t PowerReportIntervalUs = 60LL * 60 * 1000 * 1000; // 1 hour
+#endif
+
+static void
+configurePowerManagement()
+{
+#if CONFIG_PM_ENABLE
+    // Run at full speed when any PM lock is held (the IDF I2C, ADC, WiFi and
+    // http client drivers take their own locks around transfers) and drop to
+    // the XTAL frequency with automatic light sleep otherwise.
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        mil::System::logI(TAG, "Power management not enabled: %s", esp_err_to_name(err));
+    }
+#endif
+}
+
+static void
+reportPowerManagement()
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS || CONFIG_ETHERCLOCK_PM_LOCK_REPORT
+    static int64_t lastReport = 0;
+    int64_t now = esp_timer_get_time();
+    if (now - lastReport < PowerReportIntervalUs) {
+        return;
+    }
+    lastReport = now;
+#endif
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    // Share of CPU time the idle task got since the last report. Light sleep
+    // is entered from the idle task, so this includes the time spent asleep.
+    // The counters are 32 bits and wrap, the differences don't
+    static configRUN_TIME_COUNTER_TYPE lastIdle = 0;
+    static configRUN_TIME_COUNTER_TYPE lastTotal = 0;
+    configRUN_TIME_COUNTER_TYPE idle = ulTaskGetIdleRunTimeCounter();
+    configRUN_TIME_COUNTER_TYPE total = portGET_RUN_TIME_COUNTER_VALUE();
+    configRUN_TIME_COUNTER_TYPE elapsed = total - lastTotal;
+    if (elapsed) {
+        mil::System::logI(TAG, "Power: idle %u%%", unsigned(uint64_t(idle - lastIdle) * 100 / elapsed));
+    }
+    lastIdle = idle;
+    lastTotal = total;
+#endif
+
+#if CONFIG_ETHERCLOCK_PM_LOCK_REPORT
+    // Dumps the time spent in each power mode (including light sleep) and the
+    // active time of each PM lock. Any lock shown as held here is a leak.
+    esp_pm_dump_locks(stdout);
+#endif
+}
+
 extern "C" {
 void app_main(void)
 {
     mil::System::logI(TAG, "Starting Etherclock...");
+    configurePowerManagement();
+
     Etherclock etherclock(&portal, false);
     etherclock.setup();
+    mil::System::logI(TAG, "Boot: setup done");
 
     while (true) {
         etherclock.loop();
-        vTaskDelay(1);
+        reportPowerManagement();
+        vTaskDelay(pdMS_TO_TICKS(LoopPeriodMs));
     }
 }
 }
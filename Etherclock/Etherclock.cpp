@@ -11,10 +11,27 @@
 
 static const char* TAG = "Etherclock";
 
+// Perceptual brightness curve for the DSP7S04B. The eye's response to LED
+// brightness is roughly square law, so a linear ramp of sensor levels looks
+// like it does all its work at the dim end. Indexed by BrightnessManager level.
+struct BrightnessCurve
+{
+    constexpr BrightnessCurve() : values()
+    {
+        constexpr uint32_t max = NumberOfBrightnessLevels - 1;
+        for (uint32_t i = 0; i < NumberOfBrightnessLevels; ++i) {
+            values[i] = (i * i + max / 2) / max;
+        }
+    }
+    uint8_t values[NumberOfBrightnessLevels];
+};
+
+static constexpr BrightnessCurve brightnessCurve;
+
 Etherclock::Etherclock(mil::WiFiPortal* portal, bool buttonActiveHigh, mil::RenderCB renderCB)
     : mil::Application(portal, ConfigPortalName, true)
     , _clockDisplay(renderCB)
-    , _brightnessManager([this](uint32_t b) { setBrightness(b); }, LightSensor, 
+    , _brightnessManager([this](uint32_t b) { _pendingBrightnessLevel.store(b, std::memory_order_relaxed); }, LightSensor, 
                          InvertAmbientLightLevel, MinLightSensorLevel, MaxLightSensorLevel, NumberOfBrightnessLevels)
     , _buttonManager([this](const mil::Button& b, mil::ButtonManager::Event e) { handleButtonEvent(b, e); })
     , _buttonActiveHigh(buttonActiveHigh)
@@ -24,7 +41,11 @@ Etherclock::Etherclock(mil::WiFiPortal* portal, bool buttonActiveHigh, mil::Rend
 void
 Etherclock::setup()
 {
-    mil::System::delay(500);
+#ifdef ESP_PLATFORM
+    _appTask = xTaskGetCurrentTaskHandle();
+    xTaskCreate(renderTask, "render", RenderTaskStackSize, this, RenderTaskPriority, &_renderTask);
+#endif
+
     Application::setup();
 
     setTitle((std::string("<center>MarrinTech Internet Connected Office Clock v") + Version + "</center>").c_str());
@@ -32,13 +53,44 @@ Etherclock::setup()
 
     _brightnessManager.start();
     _buttonManager.addButton(mil::Button(SelectButton, SelectButton, _buttonActiveHigh, mil::System::GPIOPinMode::InputWithPullup));
-    setBrightness(50);
+
+    // FIXME: Set a low light level until light sensor is hooked up. This replaces
+    // the first sensor reading, as the forced setBrightness(50) here used to
+    _pendingBrightnessLevel.store(-1, std::memory_order_relaxed);
+    _frame.brightness = InitialBrightness;
+    postFrame();
 }   
 
 void
 Etherclock::loop()
 {
     Application::loop();
+
+    int32_t level = _pendingBrightnessLevel.exchange(-1, std::memory_order_relaxed);
+    if (level >= 0) {
+        setBrightness(level);
+    }
+    if (_showInfoDue.exchange(false, std::memory_order_relaxed)) {
+        // A tick that comes in after the done timer has put the time back (the
+        // loop was blocked) would paint over it, so drop it and end the sequence
+        auto elapsed = std::chrono::steady_clock::now() - _infoStart;
+        if (elapsed >= std::chrono::milliseconds(SecondaryTimePerInfo * int(Info::Done))) {
+            _info = Info::Done;
+        } else {
+            showInfoSequence();
+        }
+    }
+
+#ifdef ESP_PLATFORM
+    if (_charsDeferred.exchange(false, std::memory_order_relaxed)) {
+        Frame deferred;
+        {
+            std::lock_guard<std::mutex> lock(_deferredMutex);
+            deferred = _deferredChars;
+        }
+        showChars(deferred.chars, deferred.dps, deferred.colon);
+    }
+#endif
 }   
 
 void
@@ -53,6 +105,31 @@ Etherclock::handleButtonEvent(const mil::Button& button, mil::ButtonManager::Eve
 	}
 }
 
+void
+Etherclock::setBrightness(uint32_t level)
+{
+    if (level >= NumberOfBrightnessLevels) {
+        level = NumberOfBrightnessLevels - 1;
+    }
+
+    // Ignore small changes so a sensor sitting on a level boundary, or under
+    // fluorescent lighting, doesn't make the display flicker. Always accept
+    // the ends of the range so full dark and full bright are reachable.
+    int32_t delta = abs(int32_t(level) - _brightnessLevel);
+    if (_brightnessLevel >= 0 && delta < int32_t(BrightnessHysteresis) &&
+            level != 0 && level != NumberOfBrightnessLevels - 1) {
+        return;
+    }
+    _brightnessLevel = level;
+
+    uint8_t b = brightnessCurve.values[level];
+    if (b == _frame.brightness) {
+        return;
+    }
+    _frame.brightness = b;
+    postFrame();
+}
+
 void
 Etherclock::showString(mil::Message m)
 {
@@ -125,6 +202,12 @@ Etherclock::showMain(bool force)
     // If we are forced or the time has changed, show it
     if (force || _lastHour != hour || _lastMinute != minute || _lastDps != dps) {
         showChars(string.c_str(), dps, true);
+
+        // Log timestamps mark the boot phases. This one ends power on to first valid display
+        if (clock() && !_timeShown) {
+            _timeShown = true;
+            mil::System::logI(TAG, "Boot: first time display");
+        }
     }
     
     _lastHour = hour;
@@ -136,6 +219,7 @@ void
 Etherclock::showSecondary()
 {
     _info = Info::Day;
+    _infoStart = std::chrono::steady_clock::now();
     showInfoSequence();
     startShowDoneTimer(SecondaryTimePerInfo * int(Info::Done));
 }
@@ -152,7 +236,7 @@ Etherclock::showInfoSequence()
     switch(_info) {
         case Info::Done: break;
         case Info::Day: {
-            string = clock()->strftime("%a", clock() ? clock()->currentTime() : 0);
+            string = dayString(clock() ? clock()->currentTime() : 0);
             
             // 'M' and 'W' are the problematic character. Represent
             // 'M' with 'R7' and 'W' with 'LJ'
@@ -218,7 +302,28 @@ Etherclock::showInfoSequence()
     }
     
     showChars(string.c_str(), 0, false);
-    _showInfoTimer.once_ms(SecondaryTimePerInfo, [this]() { showInfoSequence(); });
+
+    // The done timer started in showSecondary() ends the sequence, so don't
+    // arm another tick after the last item. Each tick is a fixed offset from
+    // the start of the sequence, so time lost in a blocked loop doesn't push
+    // the remaining items past the done timer
+    if (_info != Info::Done) {
+        auto due = _infoStart + std::chrono::milliseconds(SecondaryTimePerInfo * int(_info));
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()).count();
+        _showInfoTimer.once_ms(delay > 1 ? uint32_t(delay) : 1, [this]() { _showInfoDue.store(true, std::memory_order_relaxed); });
+    }
+}
+
+const std::string&
+Etherclock::dayString(time_t t)
+{
+    // The day name only changes at midnight, so only format it when the day changes
+    time_t day = t / SecondsPerDay;
+    if (day != _dayNameDay) {
+        _dayNameDay = day;
+        _dayName = clock()->strftime("%a", t);
+    }
+    return _dayName;
 }
 
 void
@@ -230,12 +335,73 @@ Etherclock::showChars(const char* string, uint8_t dps, bool colon)
         return;
     }
 
+#ifdef ESP_PLATFORM
+    // Anything else calling in leaves the frame to loop(), so _frame and
+    // _frames are only ever touched by the application task
+    if (_appTask && xTaskGetCurrentTaskHandle() != _appTask) {
+        {
+            std::lock_guard<std::mutex> lock(_deferredMutex);
+            memcpy(_deferredChars.chars, string, 4);
+            _deferredChars.dps = dps;
+            _deferredChars.colon = colon;
+        }
+        _charsDeferred.store(true, std::memory_order_relaxed);
+        return;
+    }
+#endif
+
+    memcpy(_frame.chars, string, 4);
+    _frame.dps = dps;
+    _frame.colon = colon;
+    postFrame();
+}
+
+void
+Etherclock::postFrame()
+{
+    _frames.post(_frame);
+
+#ifdef ESP_PLATFORM
+    if (_renderTask) {
+        xTaskNotifyGive(_renderTask);
+        return;
+    }
+#endif
+    render();
+}
+
+void
+Etherclock::render()
+{
+    Frame frame;
+    if (!_frames.take(frame)) {
+        return;
+    }
+
+    if (_renderedBrightness != frame.brightness) {
+        _renderedBrightness = frame.brightness;
+        _clockDisplay.setBrightness(frame.brightness);
+    }
+
     _clockDisplay.clearDisplay();
-    _clockDisplay.print(string);
-    _clockDisplay.setColon(colon);
+    _clockDisplay.print(frame.chars);
+    _clockDisplay.setColon(frame.colon);
 
-    if (dps) {
+    if (frame.dps) {
         _clockDisplay.setDot(3, true);
     }
     _clockDisplay.refresh();
 }
+
+#ifdef ESP_PLATFORM
+void
+Etherclock::renderTask(void* param)
+{
+    Etherclock* self = reinterpret_cast<Etherclock*>(param);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        self->render();
+    }
+}
+#endif
@@ -25,6 +25,16 @@
 #include "BrightnessManager.h"
 #include "ButtonManager.h"
 #include "DSP7S04B.h"
+#include "FrameMailbox.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
 
 static constexpr const char* ConfigPortalName = "MT Etherclock";
 static constexpr const char* Hostname = "officeclock";
@@ -43,8 +53,17 @@ static constexpr uint32_t NumberOfBrightnessLevels = 250;
 static constexpr bool InvertAmbientLightLevel = false;
 static constexpr uint32_t MinLightSensorLevel = 0;
 static constexpr uint32_t MaxLightSensorLevel = 300;
+static constexpr uint32_t BrightnessHysteresis = 3; // In levels
+static constexpr uint8_t InitialBrightness = 50;   // Display level forced at startup, see setup()
 
 static constexpr uint32_t SecondaryTimePerInfo = 2000; // In ms
+static constexpr time_t SecondsPerDay = 24 * 60 * 60;
+
+// Render task. On ESP the display is painted from its own task so the I2C
+// transfer doesn't hold up the application loop. Frames are still posted from
+// the loop, so a loop blocked by a slow fetch posts nothing new until it returns.
+static constexpr uint32_t RenderTaskStackSize = 3072;
+static constexpr uint32_t RenderTaskPriority = 2;
 
 class Etherclock : public mil::Application
 {
@@ -57,13 +76,18 @@ public:
 private:
     enum class Info { Day, Date, CurTemp, LowTemp, HighTemp, Done };
 
+    // Everything needed to paint the DSP7S04B
+    struct Frame
+    {
+        char chars[5] = "    ";
+        uint8_t dps = 0;
+        bool colon = false;
+        uint8_t brightness = InitialBrightness;
+    };
+
     void handleButtonEvent(const mil::Button& button, mil::ButtonManager::Event event);
     
-    void setBrightness(uint8_t b)
-    {
-        // FIXME: Set a low light level until light sensor is hooked up
-        _clockDisplay.setBrightness(b);
-    }
+    void setBrightness(uint32_t level);
     
     virtual void showString(mil::Message m) override;
 	virtual void showMain(bool force = false) override;
@@ -71,10 +95,44 @@ private:
 	void showInfoSequence();
 	void showChars(const char* string, uint8_t dps, bool colon);
 
+    // Returns the abbreviated day name ("Mon") for the given time
+    const std::string& dayString(time_t t);
+
+    void postFrame();
+    void render();
+
+#ifdef ESP_PLATFORM
+    static void renderTask(void* param);
+    TaskHandle_t _renderTask = nullptr;
+    TaskHandle_t _appTask = nullptr;    // The one producer of _frames
+#endif
+
     mil::DSP7S04B _clockDisplay;
 
+    // Frames are only posted from the application task. The info timer and
+    // light sensor callbacks may run elsewhere (e.g. the esp_timer task), so
+    // they just leave their work here for loop()
+    std::atomic<bool> _showInfoDue { false };
+    std::atomic<int32_t> _pendingBrightnessLevel { -1 };
+
+#ifdef ESP_PLATFORM
+    // showChars() called off the application task (e.g. from a mil::Application
+    // timer) is deferred to loop() through here. Only the final showChars() is
+    // deferred: showMain() and showString() still update _lastHour, _lastMinute,
+    // _lastDps and the done timer on whatever task calls them
+    std::mutex _deferredMutex;
+    Frame _deferredChars;                       // Guarded by _deferredMutex
+    std::atomic<bool> _charsDeferred { false };
+#endif
+
+    Frame _frame;                   // Last frame built by the application
+    FrameMailbox<Frame> _frames;
+    int _renderedBrightness = -1;   // Owned by render()
+    int32_t _brightnessLevel = -1;  // Last accepted BrightnessManager level
+
 	Info _info = Info::Done;
 	mil::Ticker _showInfoTimer;
+    std::chrono::steady_clock::time_point _infoStart; // When showSecondary() started the sequence
     
 	mil::BrightnessManager _brightnessManager;
 	mil::ButtonManager _buttonManager;
@@ -83,4 +141,8 @@ private:
     uint8_t _lastHour = 0;
     uint8_t _lastMinute = 0;
     uint8_t _lastDps = 0;
+    bool _timeShown = false;
+
+    time_t _dayNameDay = -1;    // Day number _dayName was formatted for
+    std::string _dayName;
 };
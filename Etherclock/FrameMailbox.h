@@ -0,0 +1,71 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Etherclock
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// FrameMailbox
+//
+// Lock-free single producer/single consumer handoff of display frames. This
+// is a triple buffer: the producer fills a back buffer and swaps it with the
+// pending slot, the consumer swaps the pending slot with its front buffer.
+// Neither side ever blocks or allocates. A newer frame replaces one the
+// consumer hasn't picked up yet, which is what we want for a display: there's
+// no point painting a stale time.
+//
+// post() must only be called from one context (the application task) and
+// take() from one other context (the render task). The owner has to make sure
+// of that, e.g. by deferring posts from timer callbacks to its loop.
+
+template<typename Frame>
+class FrameMailbox
+{
+public:
+    // Returns false if an unconsumed frame was replaced
+    bool post(const Frame& frame)
+    {
+        _frames[_back] = frame;
+        uint8_t prev = _pending.exchange(_back | Dirty, std::memory_order_acq_rel);
+        _back = prev & IndexMask;
+        _posted.fetch_add(1, std::memory_order_relaxed);
+        if (prev & Dirty) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Returns false if nothing new has been posted since the last take
+    bool take(Frame& frame)
+    {
+        if ((_pending.load(std::memory_order_relaxed) & Dirty) == 0) {
+            return false;
+        }
+        uint8_t prev = _pending.exchange(_front, std::memory_order_acq_rel);
+        _front = prev & IndexMask;
+        frame = _frames[_front];
+        return true;
+    }
+
+    uint32_t posted() const { return _posted.load(std::memory_order_relaxed); }
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint8_t Dirty = 0x80;
+    static constexpr uint8_t IndexMask = 0x03;
+
+    Frame _frames[3];
+    uint8_t _back = 0;                      // Owned by the producer
+    uint8_t _front = 1;                     // Owned by the consumer
+    std::atomic<uint8_t> _pending { 2 };    // Shared, index + Dirty flag
+    std::atomic<uint32_t> _posted { 0 };
+    std::atomic<uint32_t> _dropped { 0 };
+};
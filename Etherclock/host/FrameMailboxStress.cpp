@@ -0,0 +1,109 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Etherclock
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Stress run for FrameMailbox. A producer thread posts numbered frames as
+// fast as it can while a consumer thread takes them. Every field of a frame
+// is derived from its number, so a torn frame (fields from two posts) shows
+// up as a mismatch. Checks that frames arrive in order and untorn, and that
+// delivered + dropped == posted once the consumer has drained the mailbox.
+//
+//      FrameMailboxStress [posts]
+
+#include "FrameMailbox.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+static constexpr uint32_t DefaultPosts = 2000000;
+static constexpr uint32_t PostsPerYield = 16;  // So the threads interleave even on one core
+
+struct Frame
+{
+    uint32_t seq = 0;
+    uint32_t words[15] = { };   // Big enough that a torn copy is likely to be seen
+
+    void fill(uint32_t n)
+    {
+        seq = n;
+        for (uint32_t i = 0; i < 15; ++i) {
+            words[i] = n * 2654435761u + i;
+        }
+    }
+
+    bool intact() const
+    {
+        for (uint32_t i = 0; i < 15; ++i) {
+            if (words[i] != seq * 2654435761u + i) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    uint32_t posts = (argc > 1) ? uint32_t(strtoul(argv[1], nullptr, 10)) : DefaultPosts;
+
+    FrameMailbox<Frame> mailbox;
+    std::atomic<bool> producerDone { false };
+    uint32_t delivered = 0;
+    uint32_t torn = 0;
+    uint32_t outOfOrder = 0;
+    uint32_t lastSeq = 0;
+
+    std::thread consumer([&]() {
+        Frame frame;
+        while (true) {
+            // Check done before taking so the last post is always drained
+            bool done = producerDone.load(std::memory_order_acquire);
+            if (mailbox.take(frame)) {
+                delivered++;
+                if (!frame.intact()) {
+                    torn++;
+                }
+                if (frame.seq <= lastSeq) {
+                    outOfOrder++;
+                }
+                lastSeq = frame.seq;
+            } else if (done) {
+                break;
+            }
+        }
+    });
+
+    std::thread producer([&]() {
+        Frame frame;
+        for (uint32_t i = 1; i <= posts; ++i) {
+            frame.fill(i);
+            mailbox.post(frame);
+            if (i % PostsPerYield == 0) {
+                std::this_thread::yield();
+            }
+        }
+        producerDone.store(true, std::memory_order_release);
+    });
+
+    producer.join();
+    consumer.join();
+
+    printf("posted       %u\n", mailbox.posted());
+    printf("delivered    %u\n", delivered);
+    printf("dropped      %u\n", mailbox.dropped());
+    printf("torn         %u\n", torn);
+    printf("out of order %u\n", outOfOrder);
+    printf("last         %u\n", lastSeq);
+
+    bool ok = mailbox.posted() == posts && delivered + mailbox.dropped() == posts &&
+              torn == 0 && outOfOrder == 0 && lastSeq == posts;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
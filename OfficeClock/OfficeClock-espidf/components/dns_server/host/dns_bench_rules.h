@@ -0,0 +1,38 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Generated rule set for benchmarking the rule index, shared by
+// dns_server_host -r and dns_loadgen -r so both sides agree on it. Even
+// rules are exact names, odd ones "*.suffix" wildcards, and rule i answers
+// with its own address so the load generator can check which rule matched.
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BENCH_MAX_RULES (1000)
+
+static inline void bench_rule_name(char *buf, size_t len, int i)
+{
+    snprintf(buf, len, (i & 1) ? "*.zone%d.bench.test" : "host%d.bench.test", i);
+}
+
+// A name that matches rule i and no other
+static inline void bench_query_name(char *buf, size_t len, int i)
+{
+    snprintf(buf, len, (i & 1) ? "www.zone%d.bench.test" : "host%d.bench.test", i);
+}
+
+// 10.0.0.0/16 in network order
+static inline uint32_t bench_rule_addr(int i)
+{
+    return htonl(0x0a000000 | (uint32_t)(i + 1));
+}
@@ -0,0 +1,310 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Load generator for the captive portal DNS server. Sends a mix of A, AAAA,
+// multi-question and malformed queries, keeping a window of queries in
+// flight, and reports queries per second and reply latency percentiles.
+//
+//      dns_loadgen [-s server] [-p port] [-n queries] [-w window] [-m a,aaaa,multi,bad] [-r rules]
+//
+// The mix is four relative weights, e.g. "-m 70,10,10,10". Malformed queries
+// are dropped by the server, so they're sent but not waited on.
+//
+// -r queries across the generated rule set instead of the fixed names below,
+// half exact names and half names under "*.suffix" rules. Start the server
+// with the same dns_server_host -r count. Every A reply is then checked for
+// the address of the rule its name should have matched.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dns_bench_rules.h"
+
+#define DEFAULT_PORT (5353)
+#define DEFAULT_QUERIES (100000)
+#define DEFAULT_WINDOW (32)
+#define REPLY_TIMEOUT_MS (1000)
+#define MAX_QUERY_LEN (512)
+
+typedef enum { QUERY_A, QUERY_AAAA, QUERY_MULTI, QUERY_BAD, NUM_QUERY_KINDS } query_kind_t;
+
+static const char *kind_names[NUM_QUERY_KINDS] = { "A", "AAAA", "multi", "malformed" };
+
+static const char *names[] = {
+    "captive.apple.com", "connectivitycheck.gstatic.com", "www.msftconnecttest.com",
+    "clients3.google.com", "detectportal.firefox.com", "api.example.com",
+};
+
+typedef struct {
+    bool outstanding;
+    query_kind_t kind;
+    int rule;           // Generated rule the name should match, or -1
+    int64_t sent_us;
+} slot_t;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int add_question(uint8_t *buf, int len, const char *name, uint16_t type)
+{
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        int label_len = dot ? (int)(dot - name) : (int)strlen(name);
+        buf[len++] = label_len;
+        memcpy(buf + len, name, label_len);
+        len += label_len;
+        name += label_len + (dot ? 1 : 0);
+    }
+    buf[len++] = 0;
+    buf[len++] = type >> 8;
+    buf[len++] = type & 0xff;
+    buf[len++] = 0;
+    buf[len++] = 1;  // Class IN
+    return len;
+}
+
+static int build_query(uint8_t *buf, uint16_t id, query_kind_t kind, uint32_t seq, int rule)
+{
+    const char *name = names[seq % (sizeof(names) / sizeof(names[0]))];
+    char rule_name[64];
+    if (rule >= 0) {
+        bench_query_name(rule_name, sizeof(rule_name), rule);
+        name = rule_name;
+    }
+    int qd_count = kind == QUERY_MULTI ? 3 : 1;
+
+    memset(buf, 0, 12);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xff;
+    buf[2] = 0x01;  // RD
+    buf[5] = qd_count;
+
+    int len = 12;
+    switch (kind) {
+        case QUERY_A:
+            len = add_question(buf, len, name, 1);
+            break;
+        case QUERY_AAAA:
+            len = add_question(buf, len, name, 28);
+            break;
+        case QUERY_MULTI:
+            len = add_question(buf, len, name, 1);
+            len = add_question(buf, len, "www.example.com", 28);
+            len = add_question(buf, len, "portal.example.com", 1);
+            break;
+        case QUERY_BAD:
+            // Claims a question but the name runs off the end of the packet
+            len = add_question(buf, len, name, 1);
+            len -= 8;
+            break;
+        default:
+            break;
+    }
+    return len;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Address of the single answer in an A reply, 0 if there isn't exactly one
+static uint32_t answer_addr(const uint8_t *reply, int len)
+{
+    if (len < 16 || reply[6] != 0 || reply[7] != 1) {
+        return 0;
+    }
+    uint32_t addr;
+    memcpy(&addr, reply + len - 4, sizeof(addr));
+    return addr;
+}
+
+static bool parse_mix(const char *arg, int *weights)
+{
+    return sscanf(arg, "%d,%d,%d,%d", &weights[0], &weights[1], &weights[2], &weights[3]) == NUM_QUERY_KINDS;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = "127.0.0.1";
+    int port = DEFAULT_PORT;
+    uint32_t num_queries = DEFAULT_QUERIES;
+    int window = DEFAULT_WINDOW;
+    int weights[NUM_QUERY_KINDS] = { 70, 10, 10, 10 };
+    int num_of_rules = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:n:w:m:r:")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': num_queries = strtoul(optarg, NULL, 10); break;
+            case 'w': window = atoi(optarg); break;
+            case 'r': num_of_rules = atoi(optarg); break;
+            case 'm':
+                if (!parse_mix(optarg, weights)) {
+                    fprintf(stderr, "mix must be 4 weights: a,aaaa,multi,bad\n");
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s server] [-p port] [-n queries] [-w window] [-m a,aaaa,multi,bad] [-r rules]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int total_weight = 0;
+    for (int i = 0; i < NUM_QUERY_KINDS; ++i) {
+        total_weight += weights[i];
+    }
+    if (total_weight <= 0 || window <= 0 || window > 65536 || num_queries == 0 ||
+            num_of_rules < 0 || num_of_rules > BENCH_MAX_RULES) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, server, &addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid server address '%s'\n", server);
+        return 1;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // Query ids index the in-flight slots
+    slot_t *slots = calloc(65536, sizeof(slot_t));
+    int64_t *latencies = calloc(num_queries, sizeof(int64_t));
+    if (!slots || !latencies) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    uint32_t sent[NUM_QUERY_KINDS] = { 0 };
+    uint32_t num_sent = 0;
+    uint32_t num_replies = 0;
+    uint32_t num_lost = 0;
+    uint32_t num_wrong = 0;
+    int outstanding = 0;
+    uint16_t next_id = 0;
+    int64_t last_progress_us = now_us();
+    int64_t start_us = last_progress_us;
+
+    while (num_sent < num_queries || outstanding > 0) {
+        // Top up the window
+        while (num_sent < num_queries && outstanding < window) {
+            int pick = rand() % total_weight;
+            query_kind_t kind = QUERY_A;
+            while (pick >= weights[kind]) {
+                pick -= weights[kind];
+                kind++;
+            }
+
+            while (slots[next_id].outstanding) {
+                next_id++;
+            }
+            uint16_t id = next_id++;
+
+            int rule = num_of_rules ? rand() % num_of_rules : -1;
+            uint8_t query[MAX_QUERY_LEN];
+            int len = build_query(query, id, kind, num_sent, rule);
+            if (send(sock, query, len, 0) < 0) {
+                perror("send");
+                return 1;
+            }
+            num_sent++;
+            sent[kind]++;
+            if (kind != QUERY_BAD) {
+                slots[id].outstanding = true;
+                slots[id].kind = kind;
+                slots[id].rule = rule;
+                slots[id].sent_us = now_us();
+                outstanding++;
+            }
+        }
+
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int ready = poll(&pfd, 1, 10);
+        if (ready > 0) {
+            uint8_t reply[1024];
+            int len;
+            while ((len = recv(sock, reply, sizeof(reply), MSG_DONTWAIT)) >= 12) {
+                uint16_t id = (reply[0] << 8) | reply[1];
+                if (!slots[id].outstanding) {
+                    continue;
+                }
+                slots[id].outstanding = false;
+                outstanding--;
+                if (slots[id].kind == QUERY_A && slots[id].rule >= 0 &&
+                        answer_addr(reply, len) != bench_rule_addr(slots[id].rule)) {
+                    num_wrong++;
+                }
+                latencies[num_replies++] = now_us() - slots[id].sent_us;
+                last_progress_us = now_us();
+            }
+        }
+
+        // Give up on anything still outstanding if the server has gone quiet
+        if (outstanding > 0 && now_us() - last_progress_us > REPLY_TIMEOUT_MS * 1000) {
+            for (int i = 0; i < 65536; ++i) {
+                if (slots[i].outstanding) {
+                    slots[i].outstanding = false;
+                    num_lost++;
+                }
+            }
+            outstanding = 0;
+            last_progress_us = now_us();
+        }
+    }
+
+    double elapsed_s = (now_us() - start_us) / 1e6;
+    qsort(latencies, num_replies, sizeof(int64_t), compare_latency);
+
+    printf("sent         %u in %.2fs\n", num_sent, elapsed_s);
+    for (int i = 0; i < NUM_QUERY_KINDS; ++i) {
+        printf("    %-9s %u\n", kind_names[i], sent[i]);
+    }
+    printf("replies      %u\n", num_replies);
+    printf("lost         %u\n", num_lost);
+    if (num_of_rules) {
+        printf("wrong answer %u (%d rules)\n", num_wrong, num_of_rules);
+    }
+    printf("qps          %.0f\n", num_sent / elapsed_s);
+    if (num_replies) {
+        printf("latency p50  %lldus\n", (long long)latencies[num_replies / 2]);
+        printf("latency p99  %lldus\n", (long long)latencies[(uint64_t)num_replies * 99 / 100]);
+        printf("latency max  %lldus\n", (long long)latencies[num_replies - 1]);
+    }
+
+    free(slots);
+    free(latencies);
+    close(sock);
+    return (num_lost || num_wrong) ? 2 : 0;
+}
@@ -0,0 +1,302 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// Measures time to portal against dns_server_host. For each simulated client
+// it sends the DNS queries the OS makes on joining a network, all at once,
+// waits for every reply and then fetches the connectivity check URL. A query
+// with no reply costs the client its retry timeout, and so does one it can't
+// use, so every reply is checked:
+//
+//   - A replies need at least one answer
+//   - AAAA and HTTPS replies need to be an authoritative NODATA (AA, no
+//     answers) with one SOA authority record carrying DNS_SERVER_NODATA_TTL_SEC,
+//     otherwise the client can't cache it and asks again
+//   - the probe URL has to be a 302 to exactly DNS_SERVER_PORTAL_URL
+//
+//      dns_probe [-s server] [-p dns_port] [-h http_port] [-n runs]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dns_server_port.h"
+#include "dns_server.h"
+
+#define DEFAULT_DNS_PORT (5353)
+#define DEFAULT_HTTP_PORT (8080)
+#define DEFAULT_RUNS (100)
+#define DNS_TIMEOUT_MS (1000)   // Roughly what resolvers wait before retrying
+#define MAX_QUERIES (4)
+
+#define QD_TYPE_A (1)
+#define QD_TYPE_SOA (6)
+#define QD_TYPE_AAAA (28)
+#define QD_TYPE_HTTPS (65)
+
+#define QR_FLAG (0x8000)
+#define AA_FLAG (0x0400)
+#define RCODE_MASK (0x000f)
+#define HEADER_LEN (12)
+
+typedef struct {
+    const char *os;
+    const char *host;
+    uint16_t types[MAX_QUERIES];
+    int num_of_types;
+    const char *path;
+} probe_t;
+
+static const probe_t probes[] = {
+    { "iOS",     "captive.apple.com",             { QD_TYPE_A, QD_TYPE_AAAA, QD_TYPE_HTTPS }, 3, "/hotspot-detect.html" },
+    { "Android", "connectivitycheck.gstatic.com", { QD_TYPE_A, QD_TYPE_AAAA },                2, "/generate_204" },
+    { "Windows", "www.msftconnecttest.com",       { QD_TYPE_A, QD_TYPE_AAAA },                2, "/connecttest.txt" },
+};
+
+#define NUM_PROBES ((int)(sizeof(probes) / sizeof(probes[0])))
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int build_query(uint8_t *buf, uint16_t id, const char *name, uint16_t type)
+{
+    memset(buf, 0, 12);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xff;
+    buf[2] = 0x01;  // RD
+    buf[5] = 1;
+
+    int len = 12;
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        int label_len = dot ? (int)(dot - name) : (int)strlen(name);
+        buf[len++] = label_len;
+        memcpy(buf + len, name, label_len);
+        len += label_len;
+        name += label_len + (dot ? 1 : 0);
+    }
+    buf[len++] = 0;
+    buf[len++] = type >> 8;
+    buf[len++] = type & 0xff;
+    buf[len++] = 0;
+    buf[len++] = 1;  // Class IN
+    return len;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+// Steps over a (possibly compressed) name, returns the offset after it or -1
+static int skip_name(const uint8_t *buf, int len, int offset)
+{
+    while (offset < len) {
+        uint8_t label = buf[offset];
+        if (label == 0) {
+            return offset + 1;
+        }
+        if ((label & 0xc0) == 0xc0) {
+            return offset + 2 <= len ? offset + 2 : -1;
+        }
+        offset += label + 1;
+    }
+    return -1;
+}
+
+// Returns true if the reply is one the client can use for a question of this type
+static bool reply_usable(const uint8_t *reply, int len, uint16_t type)
+{
+    if (len < HEADER_LEN) {
+        return false;
+    }
+    uint16_t flags = get16(reply + 2);
+    if (!(flags & QR_FLAG) || (flags & RCODE_MASK) != 0 || get16(reply + 4) != 1) {
+        return false;
+    }
+
+    if (type == QD_TYPE_A) {
+        return get16(reply + 6) >= 1;
+    }
+
+    // Cacheable NODATA: authoritative, no answers, one SOA with the negative TTL
+    if (!(flags & AA_FLAG) || get16(reply + 6) != 0 || get16(reply + 8) != 1) {
+        return false;
+    }
+    int offset = skip_name(reply, len, HEADER_LEN);
+    if (offset < 0) {
+        return false;
+    }
+    offset = skip_name(reply, len, offset + 4);
+    if (offset < 0 || offset + 10 > len) {
+        return false;
+    }
+    return get16(reply + offset) == QD_TYPE_SOA && get32(reply + offset + 4) == DNS_SERVER_NODATA_TTL_SEC;
+}
+
+// Sends the probe's queries and waits for all the replies, counts those that
+// timed out and those that came back unusable
+static void resolve(int sock, const probe_t *probe, uint16_t id_base, int *timeouts, int *unusable)
+{
+    bool waiting[MAX_QUERIES];
+    int outstanding = probe->num_of_types;
+    for (int i = 0; i < probe->num_of_types; ++i) {
+        uint8_t query[512];
+        int len = build_query(query, id_base + i, probe->host, probe->types[i]);
+        send(sock, query, len, 0);
+        waiting[i] = true;
+    }
+
+    int64_t deadline_us = now_us() + DNS_TIMEOUT_MS * 1000;
+    while (outstanding > 0) {
+        int timeout_ms = (int)((deadline_us - now_us()) / 1000);
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        if (timeout_ms <= 0 || poll(&pfd, 1, timeout_ms) <= 0) {
+            break;
+        }
+
+        uint8_t reply[1024];
+        int len = recv(sock, reply, sizeof(reply), 0);
+        if (len < HEADER_LEN) {
+            continue;
+        }
+        int i = get16(reply) - id_base;
+        if (i >= 0 && i < probe->num_of_types && waiting[i]) {
+            waiting[i] = false;
+            outstanding--;
+            if (!reply_usable(reply, len, probe->types[i])) {
+                (*unusable)++;
+            }
+        }
+    }
+    *timeouts += outstanding;
+}
+
+// Fetches the probe URL, returns true if it was redirected to the portal
+static bool fetch(const struct sockaddr_in *addr, const probe_t *probe)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return false;
+    }
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(sock);
+        return false;
+    }
+
+    char request[256];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", probe->path, probe->host);
+    send(sock, request, len, 0);
+
+    char reply[512];
+    len = recv(sock, reply, sizeof(reply) - 1, 0);
+    close(sock);
+    if (len <= 0) {
+        return false;
+    }
+    reply[len] = '\0';
+    return strncmp(reply, "HTTP/1.1 302 ", 13) == 0 && strstr(reply, "\r\nLocation: " DNS_SERVER_PORTAL_URL "\r\n") != NULL;
+}
+
+static int compare_time(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = "127.0.0.1";
+    int dns_port = DEFAULT_DNS_PORT;
+    int http_port = DEFAULT_HTTP_PORT;
+    int runs = DEFAULT_RUNS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:h:n:")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'p': dns_port = atoi(optarg); break;
+            case 'h': http_port = atoi(optarg); break;
+            case 'n': runs = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-s server] [-p dns_port] [-h http_port] [-n runs]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (runs <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    struct sockaddr_in dns_addr = { 0 };
+    dns_addr.sin_family = AF_INET;
+    dns_addr.sin_port = htons(dns_port);
+    if (inet_pton(AF_INET, server, &dns_addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid server address '%s'\n", server);
+        return 1;
+    }
+    struct sockaddr_in http_addr = dns_addr;
+    http_addr.sin_port = htons(http_port);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&dns_addr, sizeof(dns_addr)) < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int64_t *times = calloc(runs, sizeof(int64_t));
+    if (!times) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    bool failed = false;
+    uint16_t id = 0;
+    printf("%-8s %10s %10s %9s %9s %9s\n", "client", "p50", "max", "timeouts", "unusable", "no portal");
+    for (int p = 0; p < NUM_PROBES; ++p) {
+        int timeouts = 0;
+        int unusable = 0;
+        int no_portal = 0;
+        for (int r = 0; r < runs; ++r) {
+            int64_t start_us = now_us();
+            resolve(sock, &probes[p], id, &timeouts, &unusable);
+            id += MAX_QUERIES;
+            if (!fetch(&http_addr, &probes[p])) {
+                no_portal++;
+            }
+            times[r] = now_us() - start_us;
+        }
+
+        qsort(times, runs, sizeof(int64_t), compare_time);
+        printf("%-8s %8lldus %8lldus %9d %9d %9d\n", probes[p].os, (long long)times[runs / 2],
+               (long long)times[runs - 1], timeouts, unusable, no_portal);
+        failed |= timeouts > 0 || unusable > 0 || no_portal > 0;
+    }
+
+    free(times);
+    close(sock);
+    return failed ? 2 : 0;
+}
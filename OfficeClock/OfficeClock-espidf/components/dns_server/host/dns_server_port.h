@@ -0,0 +1,262 @@
+/*-------------------------------------------------------------------------
+    This source file is a part of Clocks
+    For the latest info, see https://github.com/cmarrin/Clocks
+    Copyright (c) 2021-2026, Chris Marrin
+    All rights reserved.
+    Use of this source code is governed by the MIT license that can be
+    found in the LICENSE file.
+-------------------------------------------------------------------------*/
+
+// POSIX stand-ins for the parts of ESP-IDF, FreeRTOS and lwIP that
+// dns_server.c uses, so the same source builds as a Linux (or Mac) executable.
+// Sockets map straight to BSD sockets, tasks to detached pthreads and
+// the netif layer to a stub that answers with the loopback address and
+// counts lookups.
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// esp_err
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+
+// esp_log
+
+#define ESP_LOG_ERROR 1
+#define ESP_LOG_WARN 2
+#define ESP_LOG_INFO 3
+#define ESP_LOG_DEBUG 4
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+#define HOST_LOG(level, letter, tag, format, ...) do { \
+        if (LOG_LOCAL_LEVEL >= level) { \
+            fprintf(stderr, letter " %s: " format "\n", tag, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+
+// esp_check
+
+#define ESP_RETURN_ON_FALSE(a, err_code, log_tag, format, ...) do { \
+        if (!(a)) { \
+            ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
+            return err_code; \
+        } \
+    } while (0)
+
+// esp_timer
+
+static inline int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// FreeRTOS tasks
+
+typedef pthread_t TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdPASS 1
+#define pdFAIL 0
+#define pdMS_TO_TICKS(ms) (ms)
+
+typedef struct {
+    TaskFunction_t fn;
+    void *arg;
+} host_task_start_t;
+
+static inline void *host_task_trampoline(void *param)
+{
+    host_task_start_t start = *(host_task_start_t *)param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+// Stack size and priority are ignored, the thread is detached like a FreeRTOS task
+static inline int xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, int priority, TaskHandle_t *task)
+{
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+
+    host_task_start_t *start = malloc(sizeof(host_task_start_t));
+    if (!start) {
+        return pdFAIL;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    if (pthread_create(task, NULL, host_task_trampoline, start) != 0) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(*task);
+    return pdPASS;
+}
+
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return pthread_self();
+}
+
+// Only deleting the calling task is supported
+static inline void vTaskDelete(void *task)
+{
+    (void)task;
+    pthread_exit(NULL);
+}
+
+static inline void vTaskDelay(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+// FreeRTOS mutexes
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define portMAX_DELAY 0xffffffffUL
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = malloc(sizeof(pthread_mutex_t));
+    if (mutex && pthread_mutex_init(mutex, NULL) != 0) {
+        free(mutex);
+        return NULL;
+    }
+    return mutex;
+}
+
+// Only waiting forever is supported
+static inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t ticks)
+{
+    (void)ticks;
+    pthread_mutex_lock(mutex);
+    return pdTRUE;
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_unlock(mutex);
+    return pdTRUE;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_destroy(mutex);
+    free(mutex);
+}
+
+// lwIP
+
+#define IPADDR_ANY ((uint32_t)0x00000000UL)
+
+#define inet_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET, &(addr), buf, buflen)
+#define inet6_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET6, &(addr), buf, buflen)
+
+// esp_netif
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct host_netif esp_netif_t;
+
+#define ESP_IP4TOADDR(a, b, c, d) \
+    (((uint32_t)(d) << 24) | ((uint32_t)(c) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(a))
+
+// Every netif call the server makes, so tests can check the hot path makes none
+extern _Atomic uint32_t host_netif_lookups;
+
+// Every interface key resolves to the loopback address
+static inline esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    (void)if_key;
+    atomic_fetch_add(&host_netif_lookups, 1);
+    static int host_netif;
+    return (esp_netif_t *)&host_netif;
+}
+
+static inline esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *ip_info)
+{
+    (void)netif;
+    atomic_fetch_add(&host_netif_lookups, 1);
+    memset(ip_info, 0, sizeof(*ip_info));
+    ip_info->ip.addr = ESP_IP4TOADDR(127, 0, 0, 1);
+    return ESP_OK;
+}
+
+// esp_event, addresses never change on the host so events never fire
+
+typedef const char *esp_event_base_t;
+typedef void *esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+#define IP_EVENT "IP_EVENT"
+#define ESP_EVENT_ANY_ID -1
+
+static inline esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+        esp_event_handler_t event_handler, void *event_handler_arg, esp_event_handler_instance_t *instance)
+{
+    (void)event_base;
+    (void)event_id;
+    (void)event_handler;
+    (void)event_handler_arg;
+    static int host_instance;
+    *instance = &host_instance;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_event_handler_instance_unregister(esp_event_base_t event_base, int32_t event_id,
+        esp_event_handler_instance_t instance)
+{
+    (void)event_base;
+    (void)event_id;
+    (void)instance;
+    return ESP_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -33,19 +33,52 @@
 
 #include "IDFWiFiPortal.h"
 
+#include "esp_timer.h"
+
 mil::IDFWiFiPortal portal;
 
 static const char* TAG = "OfficeClock";
 
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static constexpr int64_t IdleReportIntervalUs = 60LL * 60 * 1000 * 1000; // 1 hour
+#endif
+
+static void
+reportIdleTime()
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    // Share of CPU time the idle task got since the last report. Power management
+    // is off (the scroll loop runs every tick), so this is the headroom it would
+    // have to work with. The counters are 32 bits and wrap, the differences don't
+    static int64_t lastReport = 0;
+    static configRUN_TIME_COUNTER_TYPE lastIdle = 0;
+    static configRUN_TIME_COUNTER_TYPE lastTotal = 0;
+    int64_t now = esp_timer_get_time();
+    if (now - lastReport >= IdleReportIntervalUs) {
+        lastReport = now;
+        configRUN_TIME_COUNTER_TYPE idle = ulTaskGetIdleRunTimeCounter();
+        configRUN_TIME_COUNTER_TYPE total = portGET_RUN_TIME_COUNTER_VALUE();
+        configRUN_TIME_COUNTER_TYPE elapsed = total - lastTotal;
+        if (elapsed) {
+            mil::System::logI(TAG, "Power: idle %u%%", unsigned(uint64_t(idle - lastIdle) * 100 / elapsed));
+        }
+        lastIdle = idle;
+        lastTotal = total;
+    }
+#endif
+}
+
 extern "C" {
 void app_main(void)
 {
     mil::System::logI(TAG, "Starting OfficeClock...");
     OfficeClock officeClock(&portal, false);
     officeClock.setup();
+    mil::System::logI(TAG, "Boot: setup done");
 
     while (true) {
         officeClock.loop();
+        reportIdleTime();
         vTaskDelay(1);
     }
 }
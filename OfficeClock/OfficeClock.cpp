@@ -11,6 +11,23 @@
 
 static const char* TAG = "OfficeClock";
 
+// Perceptual brightness curve for the Max7219. The eye's response to LED
+// brightness is roughly square law, so map BrightnessManager levels onto
+// 0-MaxDisplayBrightness along a square curve rather than linearly.
+struct BrightnessCurve
+{
+    constexpr BrightnessCurve() : values()
+    {
+        constexpr uint32_t max = NumberOfBrightnessLevels - 1;
+        for (uint32_t i = 0; i < NumberOfBrightnessLevels; ++i) {
+            values[i] = (i * i * MaxDisplayBrightness + max * max / 2) / (max * max);
+        }
+    }
+    uint8_t values[NumberOfBrightnessLevels];
+};
+
+static constexpr BrightnessCurve brightnessCurve;
+
 OfficeClock::OfficeClock(mil::WiFiPortal* portal, bool buttonActiveHigh, mil::RenderCB renderCB)
     : mil::Application(portal, ConfigPortalName, true)
     , _clockDisplay([this]() { startShowDoneTimer(DoneTimeDuration); }, renderCB)
@@ -24,7 +41,6 @@ OfficeClock::OfficeClock(mil::WiFiPortal* portal, bool buttonActiveHigh, mil::Re
 void
 OfficeClock::setup()
 {
-    mil::System::delay(500);
     Application::setup();
 
     setTitle((std::string("<center>MarrinTech Internet Connected Office Clock v") + Version + "</center>").c_str());
@@ -83,21 +99,38 @@ OfficeClock::showMain(bool force)
     _lastStringSent = str;
 
     _clockDisplay.showString(str.c_str());
+
+    // Log timestamps mark the boot phases. This one ends power on to first valid display
+    if (!_timeShown) {
+        _timeShown = true;
+        mil::System::logI(TAG, "Boot: first time display");
+    }
 }
 
 void
 OfficeClock::showSecondary()
 {
     std::string time = "\v";
-    time += clock()->strftime("%a %b ", clock()->currentTime()).c_str();
-    std::string day = clock()->prettyDay(clock()->currentTime()).c_str();
-    time += day.c_str();
+    time += dateString(clock()->currentTime());
     time = time + "  " + clock()->weatherConditions() + "  Cur:" + std::to_string(clock()->currentTemp()).c_str();
     time = time + "`  Hi:" + std::to_string(clock()->highTemp()).c_str() + "`  Lo:" + std::to_string(clock()->lowTemp()).c_str() + "`";
 
     _clockDisplay.showString(time.c_str());
 }
 
+const std::string&
+OfficeClock::dateString(time_t t)
+{
+    // The date only changes at midnight, so only format it when the day changes
+    time_t day = t / SecondsPerDay;
+    if (day != _dateDay) {
+        _dateDay = day;
+        _date = clock()->strftime("%a %b ", t).c_str();
+        _date += clock()->prettyDay(t).c_str();
+    }
+    return _date;
+}
+
 void
 OfficeClock::showString(mil::Message m)
 {
@@ -138,12 +171,26 @@ OfficeClock::showString(mil::Message m)
 }
 
 void
-OfficeClock::setBrightness(uint32_t b) {
-    // Brightness needs to be 0-31 but anything more than 15 is way too bright. Adjust
-    b /= 2;
+OfficeClock::setBrightness(uint32_t level)
+{
+    if (level >= NumberOfBrightnessLevels) {
+        level = NumberOfBrightnessLevels - 1;
+    }
 
-    if (b > 31) {
-        b = 31;
+    // Ignore small changes so a sensor sitting on a level boundary, or under
+    // fluorescent lighting, doesn't make the display flicker. Always accept
+    // the ends of the range so full dark and full bright are reachable.
+    int32_t delta = abs(int32_t(level) - _brightnessLevel);
+    if (_brightnessLevel >= 0 && delta < int32_t(BrightnessHysteresis) &&
+            level != 0 && level != NumberOfBrightnessLevels - 1) {
+        return;
+    }
+    _brightnessLevel = level;
+
+    uint8_t b = brightnessCurve.values[level];
+    if (b == _brightness) {
+        return;
     }
+    _brightness = b;
     _clockDisplay.setBrightness(b);
 }
@@ -29,10 +29,13 @@ static constexpr uint32_t DateScrollRate = 50;
 static constexpr uint8_t SelectButton = 14;
 static constexpr uint32_t LightSensor = 1;
 static constexpr uint32_t NumberOfBrightnessLevels = 31;
+static constexpr uint32_t BrightnessHysteresis = 2; // In levels
+static constexpr uint32_t MaxDisplayBrightness = 15; // Max7219 goes to 31, but anything over 15 is way too bright
 static constexpr bool InvertAmbientLightLevel = true;
 static constexpr uint32_t MinLightSensorLevel = 200; // based on a 10 bit (scaled) value
 static constexpr uint32_t MaxLightSensorLevel = 950; // based on a 10 bit (scaled) value
 static constexpr uint32_t DoneTimeDuration = 100;
+static constexpr time_t SecondsPerDay = 24 * 60 * 60;
 
 class OfficeClock : public mil::Application
 {
@@ -48,12 +51,22 @@ class OfficeClock : public mil::Application
     virtual void showString(mil::Message m) override;
 
     void handleButtonEvent(const mil::Button& button, mil::ButtonManager::Event event);
-    void setBrightness(uint32_t b);
+    void setBrightness(uint32_t level);
+
+    // Returns the formatted date ("Mon Jan 1st") for the given time
+    const std::string& dateString(time_t t);
 
     mil::Max7219Display _clockDisplay;
     mil::BrightnessManager _brightnessManager;
     mil::ButtonManager _buttonManager;
     bool _buttonActiveHigh = false;
 
+    int32_t _brightnessLevel = -1;  // Last accepted BrightnessManager level
+    int32_t _brightness = -1;       // Last value sent to the display
+
     std::string _lastStringSent;
+    bool _timeShown = false;
+
+    time_t _dateDay = -1;   // Day number _date was formatted for
+    std::string _date;
 };